@@ -0,0 +1,43 @@
+#include <iostream>
+#include "script.hpp"
+#include <string>
+#include <cstdlib>
+#include <chrono>
+
+// usage: benchmark <script> [runs]
+// compiles the script then reports the average run time (the scripts only use the built in functions)
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        std::cout << "usage: " << argv[0] << " <script> [runs]" << std::endl;
+        return 0;
+    }
+    int runs = (argc > 2 ? std::atoi(argv[2]) : 5);
+    if(runs < 1) runs = 1;
+    std::string output = std::string(argv[1]) + ".csr";
+    Script::initGlobalVariables(10);
+
+    auto s = std::chrono::steady_clock::now();
+    if(!Script::compile(argv[1], output))
+        return 0;
+    auto e = std::chrono::steady_clock::now();
+    std::cout << "Compile Time: " << std::chrono::duration<double, std::micro>(e-s).count() << " us" << std::endl;
+
+    double total = 0;
+    for(int i = 0; i < runs; ++i)
+    {
+        Script bench;
+        if(!bench.load(output))
+            return 0;
+        s = std::chrono::steady_clock::now();
+        bench.run();
+        e = std::chrono::steady_clock::now();
+        total += std::chrono::duration<double, std::milli>(e-s).count();
+    }
+    std::cout << "Run Time: " << total / runs << " ms (average of " << runs << " runs)" << std::endl;
+
+    Script::clearGlobalVariables();
+
+    return 0;
+}
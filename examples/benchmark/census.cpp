@@ -0,0 +1,32 @@
+#include <iostream>
+#include "script.hpp"
+#include <string>
+#include <cstdlib>
+
+// usage: census <script> [count]
+// compiles the script then prints its most frequent pairs of consecutive instructions (the scripts only use the built in functions)
+// a host with its own functions can call Script::census() after loading its program
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        std::cout << "usage: " << argv[0] << " <script> [count]" << std::endl;
+        return 0;
+    }
+    size_t count = (argc > 2 ? std::atoi(argv[2]) : 20);
+    std::string output = std::string(argv[1]) + ".csr";
+    Script::initGlobalVariables(10);
+
+    if(!Script::compile(argv[1], output))
+        return 0;
+    Script s;
+    if(!s.load(output))
+        return 0;
+    auto pairs = s.census();
+    for(size_t i = 0; i < pairs.size() && i < count; ++i)
+        std::cout << pairs[i].second << "\t" << pairs[i].first << std::endl;
+
+    Script::clearGlobalVariables();
+
+    return 0;
+}
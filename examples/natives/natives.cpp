@@ -0,0 +1,63 @@
+#include <iostream>
+#include "script.hpp"
+
+// usage: natives [script]
+// checks that host functions named like builtins replace them and that the builtin names stay usable as variables
+// prints the failed checks and returns 1 if there is any
+int result = 0; // bound to the @result global variable
+int calls = 0; // host function calls
+
+void hostSize(Script* s, Line& l)
+{
+    ++calls;
+    s->funcReturn(100, l);
+}
+
+void hostMax(Script* s, Line& l)
+{
+    ++calls;
+    s->funcReturn(1000, l);
+}
+
+void hostRemove(Script* s, Line& l)
+{
+    ++calls;
+    s->funcReturn(10000, l);
+}
+
+int main(int argc, char** argv)
+{
+    std::string file = (argc > 1 ? argv[1] : "natives.txt");
+    Script::addGlobalFunction("size", hostSize, 1);
+    Script::addGlobalFunction("max", hostMax, 2);
+    Script::addGlobalFunction("remove", hostRemove, 2);
+    Script::initGlobalVariables(0);
+    Script::bindGlobalVariable(Script::addGlobalVariable("result"), &result);
+
+    int failed = 0;
+    auto check = [&failed](const bool& ok, const char* what)
+    {
+        if(!ok)
+        {
+            std::cout << "FAILED: " << what << std::endl;
+            ++failed;
+        }
+    };
+
+    std::string output = file + ".csr";
+    bool compiled = Script::compile(file, output);
+    check(compiled, "compile");
+    if(compiled)
+    {
+        Script s;
+        check(s.load(output), "load");
+        s.run();
+        check(calls == 3, "the host size(), max() and remove() are called instead of the builtins");
+        check(result == 100 + 1000 + 10000 + 6 + 1 + 3 + 2 + 5 + 2, "@result");
+    }
+
+    Script::clearGlobalVariables();
+    if(!failed)
+        std::cout << "ok" << std::endl;
+    return (failed ? 1 : 0);
+}
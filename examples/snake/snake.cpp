@@ -11,6 +11,7 @@
 const sf::Vector2i size = {20, 20};
 const enum{UP, RIGHT, DOWN, LEFT}snake_dir = UP;
 std::deque<sf::Vector2i> snake_pos;
+int snake_length = 2; // bound to the @length global variable
 std::vector<sf::Vector2i> apple_pos;
 sf::RenderWindow window;
 sf::Event event;
@@ -20,16 +21,6 @@ std::mt19937 eng(rd());
 std::uniform_int_distribution<> dX(0, size.x-1);
 std::uniform_int_distribution<> dY(0, size.y-1);
 
-void getMapWidth(Script* s, Line& l)
-{
-    s->funcReturn(size.x, l);
-}
-
-void getMapHeight(Script* s, Line& l)
-{
-    s->funcReturn(size.y, l);
-}
-
 void pushSnakePos(Script* s, Line& l)
 {
     if(s->rejectReturn(l)) return;
@@ -197,21 +188,7 @@ void eatApple(Script* s, Line& l)
 void updateSnakeLenght(Script* s, Line& l)
 {
     if(s->rejectReturn(l)) return;
-
-    int sl;
-    const void* p = s->getValueContent(l.params[0], sl);
-    if(p == nullptr)
-    {
-        s->setError();
-        return;
-    }
-    switch(sl)
-    {
-        case INT: sl = *(int*)p; break;
-        case FLOAT: sl = (int)*(float*)p; break;
-        default: s->setError(); return;
-    }
-    while(snake_pos.size() > sl)
+    while(snake_pos.size() > snake_length)
         snake_pos.pop_back();
 }
 
@@ -237,8 +214,6 @@ void clearApples(Script* s, Line& l)
 
 int main()
 {
-    Script::addGlobalFunction("getMapWidth", getMapWidth, 0);
-    Script::addGlobalFunction("getMapHeight", getMapHeight, 0);
     Script::addGlobalFunction("pushSnakePos", pushSnakePos, 2);
     Script::addGlobalFunction("checkKey", checkKey, 1);
     Script::addGlobalFunction("initWindow", initWindow, 1);
@@ -248,10 +223,14 @@ int main()
     Script::addGlobalFunction("draw", draw, 0);
     Script::addGlobalFunction("spawnApple", spawnApple, 0);
     Script::addGlobalFunction("eatApple", eatApple, 0);
-    Script::addGlobalFunction("updateSnakeLenght", updateSnakeLenght, 1);
+    Script::addGlobalFunction("updateSnakeLenght", updateSnakeLenght, 0);
     Script::addGlobalFunction("checkGameOver", checkGameOver, 0);
     Script::addGlobalFunction("clearApples", clearApples, 0);
-    Script::initGlobalVariables(10);
+    Script::addConstant("MAP_WIDTH", size.x);
+    Script::addConstant("MAP_HEIGHT", size.y);
+    for(auto name: {"posX", "posY", "dir", "keyUp", "keyRight", "keyDown", "keyLeft"})
+        Script::addGlobalVariable(name);
+    Script::bindGlobalVariable(Script::addGlobalVariable("length"), &snake_length);
 
     auto s = std::chrono::steady_clock::now();
     if(!Script::compile("snake.txt", "snake.csr"))
@@ -2,13 +2,37 @@
 #include <fstream>
 #include <sstream>
 #include <cctype>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <climits>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
 
 #include <iostream>
 
-static std::unordered_map<std::string, size_t> gl_func = {{"if", 1}, {"else", 0}, {"elif", 1}, {"return", 1}, {"while", 1}, {"print", 1}, {"debug", 1}, {"break", 0}};
-static std::unordered_map<std::string, Callback> gl_callback = {{"if", Script::_if}, {"else", Script::_else}, {"elif", Script::_if}, {"return", Script::_return}, {"while", Script::_while}, {"print", Script::_print}, {"debug", Script::_debug}, {"break", Script::_break}};
+static std::unordered_map<std::string, size_t> gl_func = {{"if", 1}, {"else", 0}, {"elif", 1}, {"return", 1}, {"while", 1}, {"print", 1}, {"debug", 1}, {"break", 0}, {"array", 1}, {"size", 1}, {"sum", 1}, {"min", 1}, {"max", 1}, {"dot", 2}, {"dict", 0}, {"keys", 1}, {"has", 2}, {"remove", 2}};
+static std::unordered_map<std::string, Callback> gl_callback = {{"if", Script::_if}, {"else", Script::_else}, {"elif", Script::_elif}, {"return", Script::_return}, {"while", Script::_while}, {"print", Script::_print}, {"debug", Script::_debug}, {"break", Script::_break}, {"array", Script::_array}, {"size", Script::_size}, {"sum", Script::_sum}, {"min", Script::_min}, {"max", Script::_max}, {"dot", Script::_dot}, {"dict", Script::_dict}, {"keys", Script::_keys}};
+static std::set<std::string> gl_builtin = {"array", "size", "sum", "min", "max", "dot", "dict", "keys", "has", "remove"}; // builtins a host function can replace, their names can also be used as variables
 static std::vector<Value> globalVars;
-#define SCRIPT_MAGIC 0x89191500
+static std::unordered_map<std::string, size_t> gl_var; // named global variables
+static std::unordered_map<std::string, int> gl_attr; // attributes of the hard-coded functions (Script::PURE, etc...)
+static std::unordered_map<std::string, std::pair<std::string, int> > gl_const; // host constants: token text and type (INT, FLOAT or STR)
+static std::string compile_cache; // compile cache folder (disabled if empty)
+static size_t inline_limit = 8; // maximum instruction count of an inlined function (0 to disable the inlining)
+#define SCRIPT_VERSION 5 // increase when the file format or the compiled code changes (part of the compile cache key)
+#define SCRIPT_MAGIC (0x89191500 | SCRIPT_VERSION)
+#define MEMO_LIMIT 65536 // maximum result count cached for a memo function (its cache is emptied when it's full)
 
 //***************************************************************************************************************
 // COMPILE
@@ -16,12 +40,15 @@ static std::vector<Value> globalVars;
 
 static const std::unordered_map<std::string, size_t> op_unordered_map = {
 {"=", 0}, {"+", 1}, {"-", 2}, {"*", 3}, {"/", 4}, {"!", 5}, {"!=", 6}, {">", 7}, {"<", 8}, {">=", 9}, {"<=", 10},
-{"==", 11}, {"&", 12}, {"^", 13}, {"|", 14}, {"&&", 15}, {"||", 16}, {"^^", 17}, {"++", 18}, {"--", 19}, {"+=", 20}, {"-=", 21},
-{"*=", 22}, {"/=", 23},  {"%", 24},  {"%=", 25}
+{"==", 11}, {"&", 12}, {"^", 13}, {"|", 14}, {"&&", 15}, {"^^", 16}, {"||", 17}, {"++", 18}, {"--", 19}, {"+=", 20}, {"-=", 21},
+{"*=", 22}, {"/=", 23},  {"%", 24},  {"%=", 25}, {"&&?", 26}, {"||?", 27}, // 26 and 27: jumps added by the compiler (short-circuit)
+{"[]", 30}, {"[]=", 31}, // element load and store (a[i], a[i] = v)
+{"has", 32}, {"remove", 33} // dictionary key test and removal: has(d, k) and remove(d, k) are compiled to operations
 };
 static const std::unordered_map<std::string, int> op_list = {
 {"=", 0}, {"+", 3}, {"-", 3}, {"*", 4}, {"/", 4}, {"%", 4}, {"%=", 0}, {"!", 2}, {"!=", 1}, {">", 1}, {"<", 1}, {">=", 1}, {"<=", 1},
-{"==", 1}, {"&", 5}, {"^", 5}, {"|", 5}, {"&&", 2}, {"||", 2}, {"^^", 2}, {"++", 6}, {"--", 6}, {"+=", 0}, {"-=", 0}, {"*=", 0}, {"/=", 0}
+{"==", 1}, {"&", 5}, {"^", 5}, {"|", 5}, {"&&", 2}, {"||", 2}, {"^^", 2}, {"++", 6}, {"--", 6}, {"+=", 0}, {"-=", 0}, {"*=", 0}, {"/=", 0},
+{"[]", 7}
 };
 
 typedef std::set<std::string> NameBank;
@@ -35,6 +62,12 @@ inline static bool isFunction(const std::string &f, const Compiled &c)
     return (gl_func.find(f) != gl_func.end() || c.find(f) != c.end());
 }
 
+// a builtin name is a variable unless it's followed by '('
+inline static bool isCall(const TokenIDList::const_iterator &it, const TokenIDList::const_iterator &end, const Compiled &c)
+{
+    return isFunction(*it, c) && (!gl_builtin.count(*it) || (it + 1 != end && *(it + 1) == "("));
+}
+
 inline static bool isCondition(const std::string &f)
 {
     return (f == "if" || f == "else" || f == "elif" || f == "while");
@@ -82,15 +115,26 @@ static int detectType(const std::string &s) // I made my own thing instead of us
         }
         return (dot == 1 ? 2 : 1); // float : int
     }
-    else if(s[0] == '@') // global variable name ?
+    else if(s[0] == '@') // global variable id or name ?
     {
         if(s.size() == 1) return -1;
+        bool named = !std::isdigit(s[1]);
         for(size_t i = 1; i < s.size(); ++i)
         {
-            if(!std::isdigit(s[i])) return -1;
+            if(!std::isdigit(s[i]) && !(named && (isalpha(s[i]) || s[i] == '_'))) return -1;
         }
         return 4; // gvar
     }
+    else if(s[0] == '$') // script variable name ?
+    {
+        if(s.size() == 1 || std::isdigit(s[1])) return -1;
+        for(size_t i = 1; i < s.size(); ++i)
+        {
+            if(!isalnum(s[i]) && s[i] != '_')
+                return -1;
+        }
+        return 5; // svar
+    }
     else // variable name ?
     {
         for(auto &c: s)
@@ -102,6 +146,11 @@ static int detectType(const std::string &s) // I made my own thing instead of us
     }
 }
 
+static bool isAssignmentOp(const std::string &op)
+{
+    return (op == "=" || op == "+=" || op == "-=" || op == "*=" || op == "/=" || op == "%=" || op == "++" || op == "--");
+}
+
 static bool isSingleOp(const std::string &op)
 {
     // checking: (op == "!" || op == "++" || op == "--");
@@ -134,15 +183,294 @@ inline static bool equal_precedence(const std::string &op1, const std::string &o
     return op_list.at(op1) == op_list.at(op2);
 }
 
+// key of a compiled file in the compile cache
+// everything changing the compiler output is hashed (FNV-1a): the source, the hard-coded functions, the global variables (count and names), the constants and the compiler build
+static std::string cacheKey(const std::string& source)
+{
+    uint64_t h = 14695981039346656037ULL;
+    auto feed = [&h](const std::string& s)
+    {
+        for(auto c: s)
+        {
+            h ^= (unsigned char)c;
+            h *= 1099511628211ULL;
+        }
+        h ^= 0xff; // separator
+        h *= 1099511628211ULL;
+    };
+
+    feed(source);
+    std::map<std::string, size_t> funcs(gl_func.begin(), gl_func.end()); // sorted, unordered_map order isn't stable
+    for(auto &xi: funcs)
+        feed(xi.first + ":" + std::to_string(xi.second) + ":" + std::to_string(gl_attr.count(xi.first) ? gl_attr[xi.first] : 0) + (gl_builtin.count(xi.first) ? ":builtin" : ""));
+    feed(std::to_string(globalVars.size()));
+    std::map<std::string, size_t> gvars(gl_var.begin(), gl_var.end());
+    for(auto &xi: gvars)
+        feed(xi.first + ":" + std::to_string(xi.second));
+    std::map<std::string, std::pair<std::string, int> > consts(gl_const.begin(), gl_const.end());
+    for(auto &xi: consts)
+        feed(xi.first + ":" + std::to_string(xi.second.second) + ":" + xi.second.first);
+    feed(std::to_string(inline_limit));
+    feed(std::to_string(SCRIPT_VERSION)); // not the build date: a rebuild of the same version keeps the cache
+
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+    return buf;
+}
+
+// temporary file name next to file, unique among the processes and threads compiling at the same time (process id and count)
+static std::string tempName(const std::string& file, const std::string& suffix)
+{
+    static std::atomic<unsigned int> count(0);
+    return file + "." + std::to_string(getpid()) + "." + std::to_string(count++) + suffix;
+}
+
+static bool writeFile(const std::string& file, const std::vector<char>& data)
+{
+    std::ofstream o(file, std::ios::out | std::ios::trunc | std::ios::binary);
+    if(!o)
+        return false;
+    o.write(data.data(), data.size());
+    return o.good();
+}
+
+static bool copyFile(const std::string& src, const std::string& dst)
+{
+    std::ifstream i(src, std::ios::in | std::ios::binary);
+    if(!i)
+        return false;
+    std::ofstream o(dst, std::ios::out | std::ios::trunc | std::ios::binary);
+    if(!o)
+        return false;
+    o << i.rdbuf();
+    return o.good();
+}
+
+// compile statistics helpers
+thread_local std::atomic<size_t>* Token::allocations = nullptr;
+
+void Token::count()
+{
+    if(allocations)
+        ++*allocations;
+}
+
+// while it exists (if on), counts the Token allocations of one compile: of its thread and of the ThreadPool workers running its steps
+struct TokenCounting
+{
+    TokenCounting(const bool& on): previous(Token::allocations), total(0) { if(on) Token::allocations = &total; }
+    ~TokenCounting() { Token::allocations = previous; }
+    std::atomic<size_t>* previous;
+    std::atomic<size_t> total;
+};
+
+static size_t tokenAllocations()
+{
+    return (Token::allocations ? Token::allocations->load() : 0);
+}
+
+struct PhaseStart
+{
+    std::chrono::steady_clock::time_point time;
+    size_t tokenAllocations;
+};
+
+static PhaseStart phaseStart()
+{
+    return {std::chrono::steady_clock::now(), tokenAllocations()};
+}
+
+static void phaseEnd(CompileStats* stats, const int& phase, const PhaseStart& start, const size_t& tokens, const size_t& instructions)
+{
+    if(!stats) return;
+    // a phase can run several times (streaming mode): times and allocations add up, counts keep their peak
+    CompileStats::Phase& p = stats->phase[phase];
+    p.time += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start.time).count();
+    p.tokenAllocations += tokenAllocations() - start.tokenAllocations;
+    p.tokens = std::max(p.tokens, tokens);
+    p.instructions = std::max(p.instructions, instructions);
+}
+
+static size_t countInstructions(const Compiled& code)
+{
+    size_t n = 0;
+    for(auto &xi: code)
+        n += xi.second.line.size();
+    return n;
+}
+
+static size_t countTokens(const Compiled& code)
+{
+    size_t n = 0;
+    for(auto &xi: code)
+        for(auto &xj: xi.second.line)
+            n += 1 + xj.params.size();
+    return n;
+}
+
+std::string CompileStats::toJSON() const
+{
+    static const char* names[PHASE_COUNT] = {"tokenize", "shuntingyard", "format", "errorCheck", "postprocessing", "save"};
+    std::ostringstream o;
+    o << "{\"cached\": " << (cached ? "true" : "false") << ", \"time\": " << time << ", \"phases\": {";
+    for(int i = 0; i < PHASE_COUNT; ++i)
+    {
+        o << (i ? ", " : "") << "\"" << names[i] << "\": {\"time\": " << phase[i].time << ", \"tokenAllocations\": " << phase[i].tokenAllocations
+          << ", \"tokens\": " << phase[i].tokens << ", \"instructions\": " << phase[i].instructions << "}";
+    }
+    o << "}}";
+    return o.str();
+}
+
+// read only stream buffer over a block of memory (used to load a program without copying it)
+struct MemoryBuffer: public std::streambuf
+{
+    MemoryBuffer(const std::vector<char>& data)
+    {
+        char* p = const_cast<char*>(data.data());
+        setg(p, p, p + data.size());
+    }
+};
+
+// the per function steps can run in parallel
+static size_t threadCount(const char &flag)
+{
+    size_t threads = 1;
+    if(flag & Script::PARALLEL)
+    {
+        threads = std::thread::hardware_concurrency();
+        if(threads == 0) threads = 1;
+    }
+    return threads;
+}
+
+// threads - 1 workers, started once per compile and reused by every step (the calling thread is the last one)
+class ThreadPool
+{
+    public:
+        ThreadPool(const size_t& threads): job(nullptr), generation(0), running(0), quit(false), allocations(nullptr)
+        {
+            for(size_t t = 1; t < threads; ++t)
+                workers.push_back(std::thread(&ThreadPool::work, this));
+        }
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                quit = true;
+            }
+            wake.notify_all();
+            for(auto &t: workers)
+                t.join();
+        }
+        size_t size() const { return workers.size() + 1; }
+        void run(const std::function<void()>& foo) // calls foo on every thread, returns once they are all done
+        {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                job = &foo;
+                allocations = Token::allocations; // the statistics of the calling compile
+                running = workers.size();
+                ++generation;
+            }
+            wake.notify_all();
+            foo();
+            std::unique_lock<std::mutex> lock(m);
+            done.wait(lock, [this]() { return running == 0; });
+            job = nullptr;
+        }
+
+    private:
+        void work()
+        {
+            size_t seen = 0;
+            std::unique_lock<std::mutex> lock(m);
+            while(true)
+            {
+                wake.wait(lock, [this, &seen]() { return quit || generation != seen; });
+                if(quit) return;
+                seen = generation;
+                const std::function<void()>* foo = job;
+                Token::allocations = allocations;
+                lock.unlock();
+                (*foo)();
+                lock.lock();
+                if(--running == 0)
+                    done.notify_one();
+            }
+        }
+
+        std::vector<std::thread> workers;
+        std::mutex m;
+        std::condition_variable wake; // a job or quit
+        std::condition_variable done; // the workers finished the job
+        const std::function<void()>* job;
+        size_t generation; // job count, a worker runs each one once
+        size_t running; // workers still on the job
+        bool quit;
+        std::atomic<size_t>* allocations;
+};
+
+// call foo on every function of code, spread over the threads of pool (on this thread only if there are less than 2 functions)
+// results are kept in the iteration order of code: the returned error (first non zero result) doesn't depend on the scheduling
+static int forEachFunction(Compiled& code, ThreadPool& pool, const std::function<int(const std::string&, Code&)>& foo)
+{
+    std::vector<Compiled::value_type*> funcs;
+    for(auto &xi: code)
+        funcs.push_back(&xi);
+
+    if(pool.size() <= 1 || funcs.size() < 2)
+    {
+        int r;
+        for(auto xi: funcs)
+            if((r = foo(xi->first, xi->second)) != 0)
+                return r;
+        return 0;
+    }
+
+    std::vector<int> results(funcs.size(), 0);
+    std::atomic<size_t> next(0);
+    pool.run([&]()
+    {
+        size_t i;
+        while((i = next++) < funcs.size())
+            results[i] = foo(funcs[i]->first, funcs[i]->second);
+    });
+
+    for(auto r: results)
+        if(r != 0)
+            return r;
+    return 0;
+}
+
 //***************************************************************************************************************
 // RUN
 //***************************************************************************************************************
 void Value::clear()
 {
+    if(bound) return; // the host owns it
     switch(t)
     {
-        case FUNC: case STR: delete (std::string*)p; break;
-        case INT: case COP: case RESULT: case CVAR: case CFUNC: case GVAR: delete (int*)p; break;
+        case STR:
+        {
+            SharedString* sh = static_cast<SharedString*>((std::string*)p);
+            if(--sh->refs == 0) delete sh;
+            break;
+        }
+        case FUNC: delete (std::string*)p; break;
+        case ARRAY:
+        {
+            Array* a = (Array*)p;
+            if(--a->refs == 0) delete a;
+            break;
+        }
+        case DICT:
+        {
+            Dict* d = (Dict*)p;
+            if(--d->refs == 0) delete d;
+            break;
+        }
+        case INT: case COP: case RESULT: case CVAR: case CFUNC: case GVAR: case SVAR: delete (int*)p; break;
         case FLOAT: delete (float*)p; break;
         case GFUNC: delete (CallRef*)p; break;
         case LCUR: case RCUR: default: break;
@@ -152,13 +480,47 @@ void Value::clear()
 
 bool Value::set(const void *any, const int& type)
 {
+    if(type == STR && !bound) return set(*(const std::string*)any);
+    return share(any, type);
+}
+
+bool Value::share(const void *any, const int& type)
+{
+    if(bound) return setBound(any, type);
     switch(type)
     {
-        case STR: case FUNC:
+        case STR:
+        {
+            if(t == STR && p == any) return true;
+            const SharedString* sh = static_cast<const SharedString*>((const std::string*)any);
+            ++sh->refs; // before clear(), any might only be held by this value
+            clear();
+            p = (std::string*)sh;
+            break;
+        }
+        case ARRAY:
+        {
+            if(t == ARRAY && p == any) return true;
+            const Array* a = (const Array*)any;
+            ++a->refs;
+            clear();
+            p = (Array*)a;
+            break;
+        }
+        case DICT:
+        {
+            if(t == DICT && p == any) return true;
+            const Dict* d = (const Dict*)any;
+            ++d->refs;
+            clear();
+            p = (Dict*)d;
+            break;
+        }
+        case FUNC:
             if(t != type) { clear(); p = new std::string(*(const std::string*)any); }
             else (*(std::string*)p) = (*(const std::string*)any);
             break;
-        case INT: case COP: case RESULT: case CVAR: case CFUNC: case GVAR:
+        case INT: case COP: case RESULT: case CVAR: case CFUNC: case GVAR: case SVAR:
             if(t != type) { clear(); p = new int(*(const int*)any); }
             else (*(int*)p) = (*(const int*)any);
             break;
@@ -182,6 +544,7 @@ bool Value::set(const void *any, const int& type)
 bool Value::set(const int& v)
 {
     if(t == INT) *((int*)p) = v;
+    else if(bound) return setBound(&v, INT);
     else { clear(); p = new int(v); t = INT; }
     return true;
 }
@@ -189,35 +552,271 @@ bool Value::set(const int& v)
 bool Value::set(const float& v)
 {
     if(t == FLOAT) *((float*)p) = v;
+    else if(bound) return setBound(&v, FLOAT);
     else { clear(); p = new float(v); t = FLOAT; }
     return true;
 }
 
 bool Value::set(const std::string& v)
 {
-    if(t == STR) *((std::string*)p) = v;
-    else { clear(); p = new std::string(v); t = STR; }
+    if(bound) return false;
+    if(t == STR && static_cast<SharedString*>((std::string*)p)->refs == 1) *((std::string*)p) = v; // not shared: reuse the storage
+    else { clear(); p = (std::string*)new SharedString(v); t = STR; }
+    return true;
+}
+
+bool Value::set(std::string&& v)
+{
+    if(bound) return false;
+    if(t == STR && static_cast<SharedString*>((std::string*)p)->refs == 1) *((std::string*)p) = std::move(v);
+    else { clear(); p = (std::string*)new SharedString(std::move(v)); t = STR; }
+    return true;
+}
+
+Array* Value::modifyArray()
+{
+    if(t != ARRAY) return nullptr;
+    Array* a = (Array*)p;
+    if(a->refs > 1)
+    {
+        --a->refs;
+        a = new Array(*a);
+        a->refs = 1;
+        p = a;
+    }
+    return a;
+}
+
+Dict* Value::modifyDict()
+{
+    if(t != DICT) return nullptr;
+    Dict* d = (Dict*)p;
+    if(d->refs > 1)
+    {
+        --d->refs;
+        d = new Dict(*d);
+        d->refs = 1;
+        p = d;
+    }
+    return d;
+}
+
+bool Value::move(Value& v)
+{
+    if(&v == this) return true;
+    if(bound) // the content is converted instead
+    {
+        bool r = setBound(v.p, v.t);
+        v.clear();
+        return r;
+    }
+    clear();
+    p = v.p;
+    t = v.t;
+    v.p = nullptr;
+    v.t = TBD;
+    return true;
+}
+
+void Value::bind(void* host, const int& type)
+{
+    unbind();
+    clear();
+    p = host;
+    t = type;
+    bound = true;
+}
+
+void Value::unbind()
+{
+    if(!bound) return;
+    p = nullptr;
+    t = TBD;
+    bound = false;
+}
+
+bool Value::setBound(const void* any, const int& type)
+{
+    if(type != INT && type != FLOAT) return false;
+    if(t == INT) *(int*)p = (type == INT ? *(const int*)any : (int)*(const float*)any);
+    else *(float*)p = (type == FLOAT ? *(const float*)any : (float)*(const int*)any);
     return true;
 }
 
-bool Value::operator==(const Value& rhs)
+bool Value::operator==(const Value& rhs) const
 {
     if(t != rhs.t) return false;
     switch(t)
     {
-        case INT: case RESULT: case CVAR: case COP: case GVAR: case CFUNC:
+        case INT: case RESULT: case CVAR: case COP: case GVAR: case SVAR: case CFUNC:
             return (*(int*)p == *(int*)rhs.p);
         case FLOAT:
             return (*(float*)p == *(float*)rhs.p);
-        case STR: case OPERATOR: case LBRK: case RBRK: case COMMA: case LCUR: case RCUR: case FUNC: case VAR: case TBD:
+        case STR:
+            return (p == rhs.p || *(std::string*)p == *(std::string*)rhs.p);
+        case OPERATOR: case LBRK: case RBRK: case COMMA: case LCUR: case RCUR: case FUNC: case VAR: case TBD:
             return (*(std::string*)p == *(std::string*)rhs.p);
         case GFUNC:
             return (*(CallRef*)p == *(CallRef*)rhs.p);
+        case ARRAY:
+        {
+            if(p == rhs.p) return true;
+            const Array& a = *(const Array*)p;
+            const Array& b = *(const Array*)rhs.p;
+            if(a.type != b.type || a.size() != b.size()) return false;
+            switch(a.type)
+            {
+                case INT: return a.i == b.i;
+                case FLOAT: return a.f == b.f;
+                default: return a.v == b.v;
+            }
+        }
+        case DICT:
+        {
+            if(p == rhs.p) return true;
+            const Dict& a = *(const Dict*)p;
+            const Dict& b = *(const Dict*)rhs.p;
+            if(a.size() != b.size()) return false;
+            for(auto &x: a.slots)
+            {
+                if(x.type != INT && x.type != STR) continue;
+                const Value* y = b.find(x.type == INT ? (const void*)&x.i : (const void*)x.s, x.type);
+                if(!y || !(*y == x.v)) return false;
+            }
+            return true;
+        }
         default:
             return false;
     }
 }
 
+Array::Array(const Array& a): type(a.type), i(a.i), f(a.f), v(a.v.size()), refs(0)
+{
+    for(size_t k = 0; k < v.size(); ++k) // the values share the contents of a
+        v[k].share(a.v[k].getP(), a.v[k].getType());
+}
+
+Array::~Array()
+{
+    for(auto &x: v)
+        x.clear();
+}
+
+static uint32_t keyHash(const void* key, const int& type)
+{
+    if(type == INT)
+    {
+        uint64_t h = (uint32_t)*(const int*)key * 0x9E3779B97F4A7C15ull; // the low bits pick the slot: they must depend on every bit of the key
+        return (uint32_t)(h ^ (h >> 32));
+    }
+    return (uint32_t)std::hash<std::string>()(*(const std::string*)key);
+}
+
+Dict::Dict(const Dict& d): slots(d.slots.size()), count(d.count), used(d.count), refs(0)
+{
+    for(auto &x: d.slots) // the removed keys are dropped
+    {
+        if(x.type != INT && x.type != STR) continue;
+        Slot& y = slots[lookup(x.type == INT ? (const void*)&x.i : (const void*)x.s, x.type, x.hash)];
+        y.hash = x.hash;
+        y.type = x.type;
+        if(x.type == INT) y.i = x.i;
+        else
+        {
+            y.s = x.s;
+            ++y.s->refs;
+        }
+        y.v.share(x.v.getP(), x.v.getType());
+    }
+}
+
+Dict::~Dict()
+{
+    for(auto &x: slots)
+    {
+        if(x.type != INT && x.type != STR) continue;
+        if(x.type == STR && --x.s->refs == 0) delete x.s;
+        x.v.clear();
+    }
+}
+
+size_t Dict::lookup(const void* key, const int& type, const uint32_t& hash) const
+{
+    const size_t mask = slots.size() - 1;
+    size_t k = hash & mask;
+    size_t removed = SIZE_MAX;
+    while(true) // there is always a free slot
+    {
+        const Slot& x = slots[k];
+        if(x.type == TBD)
+            return (removed != SIZE_MAX ? removed : k);
+        if(x.type == INVALID)
+        {
+            if(removed == SIZE_MAX) removed = k;
+        }
+        else if(x.type == type && x.hash == hash)
+        {
+            if(type == INT ? x.i == *(const int*)key : ((const std::string*)x.s == key || *(const std::string*)x.s == *(const std::string*)key))
+                return k;
+        }
+        k = (k + 1) & mask;
+    }
+}
+
+const Value* Dict::find(const void* key, const int& type) const
+{
+    if(count == 0) return nullptr;
+    const Slot& x = slots[lookup(key, type, keyHash(key, type))];
+    return (x.type == type ? &x.v : nullptr);
+}
+
+Value* Dict::insert(const void* key, const int& type)
+{
+    if((used + 1) * 4 > slots.size() * 3)
+        grow();
+    const uint32_t hash = keyHash(key, type);
+    Slot& x = slots[lookup(key, type, hash)];
+    if(x.type == type)
+        return &x.v;
+    if(x.type == TBD) ++used;
+    ++count;
+    x.hash = hash;
+    x.type = type;
+    if(type == INT) x.i = *(const int*)key;
+    else
+    {
+        x.s = static_cast<const SharedString*>((const std::string*)key);
+        ++x.s->refs;
+    }
+    return &x.v;
+}
+
+bool Dict::erase(const void* key, const int& type)
+{
+    if(count == 0) return false;
+    Slot& x = slots[lookup(key, type, keyHash(key, type))];
+    if(x.type != type) return false;
+    if(type == STR && --x.s->refs == 0) delete x.s;
+    x.s = nullptr;
+    x.v.clear();
+    x.type = INVALID; // the keys after it stay reachable
+    --count;
+    return true;
+}
+
+// doubles the slot count (unless the table is mostly removed keys) and drops the removed keys
+void Dict::grow()
+{
+    size_t n = (slots.empty() ? 8 : slots.size());
+    while((count + 1) * 2 > n) n *= 2;
+    std::vector<Slot> old(n);
+    old.swap(slots);
+    for(auto &x: old)
+        if(x.type == INT || x.type == STR)
+            slots[lookup(x.type == INT ? (const void*)&x.i : (const void*)x.s, x.type, x.hash)] = x; // the slot takes the key and the value
+    used = count;
+}
+
 //***************************************************************************************************************
 // MAIN CLASS
 //***************************************************************************************************************
@@ -226,6 +825,7 @@ Script::Script()
     loaded = false;
     state = STOP;
     entrypoint = SIZE_MAX;
+    silent = false;
 }
 
 Script::~Script()
@@ -240,6 +840,10 @@ Script::~Script()
     }
     for(auto &i: currentVars) i.clear();
     for(auto &i: currentRegs) i.clear();
+    for(auto &i: scriptVars) i.clear();
+    for(auto &i: memo)
+        for(auto &j: i)
+            j.second.clear();
     while(!call_stack.empty())
     {
         RunState& r = call_stack.top();
@@ -251,53 +855,168 @@ Script::~Script()
 bool Script::load(const std::string& file)
 {
     if(loaded) return false;
-    loaded = true;
-
-    // tmp vars used during the writing
-    size_t tmp;
-    char c;
-    float fv;
-    std::string buf;
-    std::vector<std::string> lfunc;
 
     std::ifstream f(file, std::ios::in | std::ios::binary);
     if(!f)
         return false;
+    return load(f);
+}
 
-    f.read((char*)&tmp, 4);
-    if(tmp != SCRIPT_MAGIC) return false;
-    f.read((char*)&tmp, 4);
-    code.resize(tmp);
-    lfunc.resize(tmp, "");
+bool Script::load(const std::vector<char>& program)
+{
+    if(loaded) return false;
 
-    for(size_t i = 0; i < lfunc.size(); ++i)
+    MemoryBuffer mb(program); // read in place, no copy
+    std::istream f(&mb);
+    return load(f);
+}
+
+// chooses the superinstructions of a function (see Line::fuse)
+// only the first line of a pair changes: the jumps and the skipped blocks see the same lines as before
+static void fuseLines(Function& func)
+{
+    for(size_t i = 0; i < func.line.size(); ++i)
     {
-        f.read((char*)&tmp, 4);
-        if(tmp)
+        Line& l = func.line[i];
+        if(l.op.getType() != COP)
+            continue;
+        int op = *(l.op.get<int>());
+        Line* next = (i+1 < func.line.size() ? &func.line[i+1] : nullptr);
+        if(op >= 6 && op <= 11 && l.hasResult && l.params.size() == 3 && l.params[2].getType() == RESULT && next &&
+           next->op.getType() == GFUNC && !next->hasResult && next->params.size() == 1 && next->params[0] == l.params[2])
         {
-            buf.resize(tmp);
-            f.read(&(buf[0]), tmp);
-            lfunc[i] = buf;
+            const std::string& name = (*(next->op.get<CallRef>()))->first;
+            if(name == "if") l.fuse = FUSE_IF;
+            else if(name == "elif") l.fuse = FUSE_ELIF;
+            else if(name == "while") l.fuse = FUSE_WHILE;
+        }
+        else if(!l.params.empty() && l.params[0].getType() == CVAR &&
+                (((op == 18 || op == 19) && !l.hasResult && l.params.size() == 1) ||
+                 ((op == 20 || op == 21) && !l.hasResult && l.params.size() == 2 && l.params[1].getType() == INT) ||
+                 ((op == 1 || op == 2) && l.hasResult && l.params.size() == 3 && l.params[1].getType() == INT && l.params[2] == l.params[0])))
+        {
+            l.fuse = ((next && next->op.getType() == RCUR) ? FUSE_INC_END : FUSE_INC);
         }
-        else entrypoint = i;
-        f.read((char*)&tmp, 4);
-        code[i].argn = tmp;
     }
-    if(entrypoint >= lfunc.size()) return false;
 
-    for(size_t i = 0; i < lfunc.size(); ++i)
+    // increment ending a loop which restarts at its comparison (the usual for loop): a single dispatch per iteration
+    for(size_t i = 0; i < func.line.size(); ++i)
     {
-        Function& func = code[i];
-
-        if(!f.good()) return false;
+        if(func.line[i].fuse != FUSE_INC_END)
+            continue;
+        int depth = 0;
+        size_t j = i+1;
+        for(; j > 0; --j) // start of the block
+        {
+            if(func.line[j].op.getType() == RCUR) ++depth;
+            else if(func.line[j].op.getType() == LCUR && --depth == 0) break;
+        }
+        if(j < 2 || func.line[j-1].op.getType() != GFUNC || func.line[j-2].fuse != FUSE_WHILE)
+            continue;
+        auto it = func.while_map.find(j-1);
+        if(it != func.while_map.end() && it->second == (int)j-2)
+            func.line[i].fuse = FUSE_FOR;
+    }
 
-        f.read((char*)&func.regn, 4);
+    // if/elif chains of at least 3 blocks, each condition being "variable == INT constant" on the same variable
+    for(size_t i = 0; i < func.line.size(); ++i)
+    {
+        if(func.line[i].fuse != FUSE_IF || *(func.line[i].op.get<int>()) != 11)
+            continue;
+        JumpTable table;
+        const Value* var = nullptr;
+        size_t j = i;
+        while(j + 2 < func.line.size() && *(func.line[j].op.get<int>()) == 11 &&
+              (func.line[j].fuse == (j == i ? FUSE_IF : FUSE_ELIF)) && func.line[j+2].op.getType() == LCUR)
+        {
+            const Line& l = func.line[j];
+            size_t k = (l.params[1].getType() == INT ? 0 : 1); // tested variable
+            int vt = l.params[k].getType();
+            if(l.params[1-k].getType() != INT || (vt != CVAR && vt != GVAR && vt != SVAR) || (var && !(*var == l.params[k])))
+                break;
+            if(!var)
+            {
+                var = &l.params[k];
+                table.param = k;
+            }
+            table.arms.insert({*(l.params[1-k].get<int>()), j+1});
+
+            // end of the block
+            int depth = 0;
+            size_t e = j+2;
+            for(; e < func.line.size(); ++e)
+            {
+                if(func.line[e].op.getType() == LCUR) ++depth;
+                else if(func.line[e].op.getType() == RCUR && --depth == 0) break;
+            }
+            if(e == func.line.size())
+                break;
+            table.other = e;
+            j = e + 1;
+            if(j >= func.line.size() || func.line[j].op.getType() != COP)
+                break;
+        }
+        if(table.arms.size() >= 3)
+        {
+            func.line[i].fuse = FUSE_SWITCH;
+            func.switch_map[i] = table;
+        }
+    }
+}
+
+bool Script::load(std::istream& f)
+{
+    if(loaded) return false;
+    loaded = true;
+
+    // tmp vars used during the writing
+    size_t tmp = 0; // only 4 bytes are read in it
+    char c;
+    float fv;
+    std::string buf;
+    std::vector<std::string> lfunc;
+    std::unordered_map<std::string, const Value*> literals; // equal string literals share their content
+
+    f.read((char*)&tmp, 4);
+    if(tmp != SCRIPT_MAGIC) return false;
+    f.read((char*)&tmp, 4);
+    scriptVars.resize(tmp);
+    f.read((char*)&tmp, 4);
+    code.resize(tmp);
+    lfunc.resize(tmp, "");
+
+    for(size_t i = 0; i < lfunc.size(); ++i)
+    {
+        f.read((char*)&tmp, 4);
+        if(tmp)
+        {
+            buf.resize(tmp);
+            f.read(&(buf[0]), tmp);
+            lfunc[i] = buf;
+        }
+        else entrypoint = i;
+        f.read((char*)&tmp, 4);
+        code[i].argn = tmp;
+    }
+    if(entrypoint >= lfunc.size()) return false;
+    memo.resize(code.size());
+
+    for(size_t i = 0; i < lfunc.size(); ++i)
+    {
+        Function& func = code[i];
+
+        if(!f.good()) return false;
+
+        f.read((char*)&func.regn, 4);
         f.read((char*)&func.varn, 4);
         f.read((char*)&tmp, 4);
+        func.memo = (tmp & 1);
+        f.read((char*)&tmp, 4);
         func.line.resize(tmp);
 
         id = i;
         pc = 0;
+        int loop = -1;
 
         for(auto &xi: func.line)
         {
@@ -347,6 +1066,19 @@ bool Script::load(const std::string& file)
             }
 
             f.read((char*)&(xi.hasResult), 1);
+            f.read(&c, 1);
+            if(c & 1) loop = pc; // the following while loops restart here
+            if(c & 2)
+            {
+                f.read((char*)&tmp, 4);
+                xi.release.resize(tmp);
+                for(auto &xj: xi.release)
+                {
+                    f.read((char*)&tmp, 4);
+                    if(tmp >= func.regn) return false;
+                    xj = tmp;
+                }
+            }
             f.read((char*)&tmp, 4);
             xi.params.resize(tmp);
 
@@ -364,9 +1096,20 @@ bool Script::load(const std::string& file)
                             buf.resize(tmp);
                             f.read(&(buf[0]), tmp);
                         }
-                        xj.set(&buf, STR);
+                        {
+                            auto it = literals.find(buf);
+                            if(it != literals.end())
+                            {
+                                xj.share(it->second->getP(), STR);
+                            }
+                            else
+                            {
+                                xj.set(buf);
+                                literals[buf] = &xj;
+                            }
+                        }
                         break;
-                    case INT: case RESULT: case CVAR: case GVAR:
+                    case INT: case RESULT: case CVAR: case GVAR: case SVAR:
                         f.read((char*)&tmp, 4);
                         xj.set(&tmp, c);
                         break;
@@ -377,10 +1120,11 @@ bool Script::load(const std::string& file)
                     default: break;
                 }
             }
-            if(xi.op.getType() == FUNC && *xi.op.get<std::string>() == "while")
-                get_while_loop_point();
+            if(xi.op.getType() == GFUNC && (*xi.op.get<CallRef>())->first == "while")
+                func.while_map[pc] = (loop < 0 ? pc : loop);
             ++pc;
         }
+        fuseLines(func);
     }
 
     currentRegs.resize(code[entrypoint].regn);
@@ -420,7 +1164,8 @@ bool Script::run()
                 break;
             }
             case COP:
-                operation(line);
+                if(line.fuse != FUSE_NONE) fusedOperation(line);
+                else operation(line);
                 break;
             case CFUNC:
             {
@@ -431,26 +1176,16 @@ bool Script::run()
                 setError("unexpected block start");
                 return false;
             case RCUR:
-                scope--;
-                if(!ifstack.empty())
-                {
-                    IfPos& ip = ifstack.top();
-                    if(ip.scope == scope)
-                    {
-                        pc = ip.pc;
-                        ifstack.pop();
-                    }
-                }
-                if(scope < 0)
-                {
-                    setError("unexpected block end");
-                }
+                endBlock();
                 break;
             default:
                 setError("invalid instruction (type: " + std::to_string(line.op.getType()));
                 return false;
         }
-        if(pc == (int)code[id].line.size() - 1)
+        for(auto &i: line.release) // strings, arrays and dictionaries no longer used (other types keep their storage)
+            if(currentRegs[i].getType() == STR || currentRegs[i].getType() == ARRAY || currentRegs[i].getType() == DICT)
+                currentRegs[i].clear();
+        while(state == PLAY && pc == (int)code[id].line.size() - 1) // a return onto the caller's last line ends the caller too
         {
             ret(nullptr);
         }
@@ -468,6 +1203,7 @@ bool Script::run()
 void Script::setError(const std::string& err)
 {
     state = ERROR;
+    if(silent) return;
     std::cout << "Error flag raised: id=" << id << ", pc=" << pc << ", scope=" << scope << std::endl;
     if(!err.empty())
         std::cout << "Message: " << err << std::endl;
@@ -481,6 +1217,7 @@ void Script::setVar(const int& i, const int& v, const int &type)
         case RESULT: p = &(currentRegs[i]); break;
         case CVAR: p = &(currentVars[i]); break;
         case GVAR: p = &(globalVars[i]); break;
+        case SVAR: p = &(scriptVars[i]); break;
         default: setError("setVar(int) error"); return;
     }
     if(!p->set(v))
@@ -495,12 +1232,28 @@ void Script::setVar(const int& i, const std::string& v, const int &type)
         case RESULT: p = &(currentRegs[i]); break;
         case CVAR: p = &(currentVars[i]); break;
         case GVAR: p = &(globalVars[i]); break;
+        case SVAR: p = &(scriptVars[i]); break;
         default: setError("setVar(string) error"); return;
     }
     if(!p->set(v))
         setError("set(string) error");
 }
 
+void Script::setVar(const int& i, std::string&& v, const int &type)
+{
+    Value* p;
+    switch(type)
+    {
+        case RESULT: p = &(currentRegs[i]); break;
+        case CVAR: p = &(currentVars[i]); break;
+        case GVAR: p = &(globalVars[i]); break;
+        case SVAR: p = &(scriptVars[i]); break;
+        default: setError("setVar(string) error"); return;
+    }
+    if(!p->set(std::move(v)))
+        setError("set(string) error");
+}
+
 void Script::setVar(const int& i, const float& v, const int &type)
 {
     Value* p;
@@ -509,6 +1262,7 @@ void Script::setVar(const int& i, const float& v, const int &type)
         case RESULT: p = &(currentRegs[i]); break;
         case CVAR: p = &(currentVars[i]); break;
         case GVAR: p = &(globalVars[i]); break;
+        case SVAR: p = &(scriptVars[i]); break;
         default: setError("setVar(float) error"); return;
     }
     if(!p->set(v))
@@ -523,20 +1277,21 @@ void Script::setVar(const int& i, const Value& v, const int &type)
         case RESULT: p = &(currentRegs[i]); break;
         case CVAR: p = &(currentVars[i]); break;
         case GVAR: p = &(globalVars[i]); break;
+        case SVAR: p = &(scriptVars[i]); break;
         default: setError("setVar(Value) error"); return;
     }
     switch(v.getType())
     {
-        case GVAR: case CVAR: case RESULT:
+        case GVAR: case SVAR: case CVAR: case RESULT:
         {
             int t;
             const void* ptr = getValueContent(v, t);
-            if(!p->set(ptr,t))
+            if(!p->share(ptr,t))
                 setError("set(Value) error");
             break;
         }
-        case INT: case FLOAT: case STR:
-            if(!p->set(v.getP(), v.getType()))
+        case INT: case FLOAT: case STR: case ARRAY: case DICT:
+            if(!p->share(v.getP(), v.getType()))
                 setError("set(Value) error");
             break;
         default: setError("setVar(Value) error");
@@ -552,6 +1307,7 @@ Value& Script::getVar(const Value& v)
         case RESULT: return currentRegs[i];
         case CVAR: return currentVars[i];
         case GVAR: return globalVars[i];
+        case SVAR: return scriptVars[i];
         default: setError("getVar() error"); return code[id].line[pc].op;
     }
 }
@@ -561,13 +1317,13 @@ const void* Script::getValueContent(const Value& v, int &type)
     const void* p = nullptr;
     switch(v.getType())
     {
-        case INT: case FLOAT: case STR: p = v.getP(); type = v.getType(); break;
-        case CVAR: case RESULT: case GVAR:
+        case INT: case FLOAT: case STR: case ARRAY: case DICT: p = v.getP(); type = v.getType(); break;
+        case CVAR: case RESULT: case GVAR: case SVAR:
         {
             Value& w = getVar(v);
             switch(w.getType())
             {
-                case INT: case FLOAT: case STR: p = w.getP(); type = w.getType(); break;
+                case INT: case FLOAT: case STR: case ARRAY: case DICT: p = w.getP(); type = w.getType(); break;
                 default: type = TBD; break;
             }
             break;
@@ -577,6 +1333,43 @@ const void* Script::getValueContent(const Value& v, int &type)
     return p;
 }
 
+std::vector<std::pair<std::string, size_t> > Script::census() const
+{
+    std::vector<std::string> ops;
+    for(auto &xi: op_unordered_map)
+    {
+        if((size_t)xi.second >= ops.size())
+            ops.resize(xi.second + 1);
+        ops[xi.second] = xi.first;
+    }
+    auto name = [&ops](const Line& l) -> std::string
+    {
+        switch(l.op.getType())
+        {
+            case COP: return ops.at(*(l.op.get<int>()));
+            case GFUNC: return (*(l.op.get<CallRef>()))->first;
+            case CFUNC: return "call";
+            case LCUR: return "{";
+            case RCUR: return "}";
+            default: return "?";
+        }
+    };
+
+    std::map<std::string, size_t> count;
+    for(auto &xi: code)
+    {
+        for(size_t i = 0; i + 1 < xi.line.size(); ++i)
+        {
+            const Line& l = xi.line[i];
+            bool fused = (l.fuse != FUSE_NONE && l.fuse != FUSE_INC);
+            ++count[name(l) + " " + name(xi.line[i+1]) + (fused ? " (fused)" : "")];
+        }
+    }
+    std::vector<std::pair<std::string, size_t> > r(count.begin(), count.end());
+    std::stable_sort(r.begin(), r.end(), [](const std::pair<std::string, size_t>& a, const std::pair<std::string, size_t>& b) { return a.second > b.second; });
+    return r;
+}
+
 #warning "clean this mess"
 void Script::enterBlock(const bool& loop)
 {
@@ -597,6 +1390,50 @@ void Script::enterBlock(const bool& loop)
     scope++;
 }
 
+void Script::endBlock()
+{
+    scope--;
+    canElse = false;
+    if(!ifstack.empty())
+    {
+        IfPos& ip = ifstack.top();
+        if(ip.scope == scope)
+        {
+            pc = ip.pc;
+            ifstack.pop();
+        }
+    }
+    if(scope < 0)
+    {
+        setError("unexpected block end");
+    }
+}
+
+// if/elif/while once the condition is known
+void Script::branch(const int& fuse, const bool& r)
+{
+    switch(fuse)
+    {
+        case FUSE_ELIF:
+            if(!canElse) // a previous block of the chain was executed
+            {
+                skipBlock(false);
+                break;
+            } // nobreak
+        case FUSE_IF:
+            if(r) enterBlock(false);
+            else skipBlock(true);
+            break;
+        case FUSE_WHILE:
+            if(r) enterBlock(true);
+            else skipBlock(false);
+            break;
+        default:
+            setError("invalid branch");
+            break;
+    }
+}
+
 void Script::skipBlock(const bool& checkElse)
 {
     if(pc+1 >= (int)code[id].line.size() || code[id].line[pc+1].op.getType() != LCUR)
@@ -624,14 +1461,57 @@ void Script::skipBlock(const bool& checkElse)
     canElse = checkElse;
 }
 
+// key of a memo call: type and content of each parameter (false if a parameter isn't a number or a string)
+bool Script::memoKey(const Line& line, const size_t& argn, std::string& key)
+{
+    if(line.params.size() - (line.hasResult ? 1 : 0) != argn)
+        return false;
+    for(size_t i = 0; i < argn; ++i)
+    {
+        int t;
+        const void* p = getValueContent(line.params[i], t);
+        key += (char)t;
+        switch(t)
+        {
+            case INT: key.append((const char*)p, sizeof(int)); break;
+            case FLOAT: key.append((const char*)p, sizeof(float)); break;
+            case STR:
+            {
+                const std::string& str = *(const std::string*)p;
+                size_t n = str.size();
+                key.append((const char*)&n, sizeof(size_t));
+                key += str;
+                break;
+            }
+            default: return false;
+        }
+    }
+    return true;
+}
+
 void Script::push_stack(Line& line)
 {
+    // a memo function called with known parameters returns the cached result
+    std::string key;
+    size_t fid = *(line.op.get<int>());
+    bool memoized = (code[fid].memo && memoKey(line, code[fid].argn, key));
+    if(memoized)
+    {
+        auto it = memo[fid].find(key);
+        if(it != memo[fid].end())
+        {
+            if(line.hasResult && !getVar(line.params.back()).share(it->second.getP(), it->second.getType()))
+                setError("set(Value) error in push_stack()");
+            return;
+        }
+    }
+
     // push the return stack (nullptr if no value expected in return)
     if(line.hasResult)
     {
         switch(line.params.back().getType())
         {
-            case RESULT: case CVAR:
+            case RESULT: case CVAR: case GVAR: case SVAR:
             {
                 return_stack.push(&getVar(line.params.back()));
                 break;
@@ -647,9 +1527,16 @@ void Script::push_stack(Line& line)
     tmp.pc = pc; // position
     tmp.id = id; // function id
     tmp.scope = scope; // scope
+    tmp.canElse = canElse; // if/elif/else chain state
+    canElse = false;
     tmp.ifstack.swap(ifstack); // if stack
     tmp.vars.swap(currentVars); // variables
     tmp.regs.swap(currentRegs);
+    if(memoized)
+    {
+        tmp.memo = true;
+        memo_keys.push_back(std::move(key));
+    }
 
     pc = -1; // function start
     id = *(line.op.get<int>()); // new function id
@@ -676,14 +1563,28 @@ void Script::push_stack(Line& line)
                 setVar(i, v, CVAR);
                 break;
             }
-            case GVAR: setVar(i, getVar(line.params[i]), CVAR); break;
+            case GVAR: case SVAR: setVar(i, getVar(line.params[i]), CVAR); break;
             default: setError("invalid parameter #" + std::to_string(i)); return;
         }
     }
 }
 
-void Script::ret(const Value* v)
+void Script::ret(Value* v, const bool& owned)
 {
+    if(!call_stack.empty() && call_stack.top().memo) // cached before v is moved
+    {
+        if(v && (v->getType() == INT || v->getType() == FLOAT || v->getType() == STR || v->getType() == ARRAY || v->getType() == DICT))
+        {
+            auto& cache = memo[id];
+            if(cache.size() >= MEMO_LIMIT)
+            {
+                for(auto &xi: cache) xi.second.clear();
+                cache.clear();
+            }
+            cache[memo_keys.back()].share(v->getP(), v->getType());
+        }
+        memo_keys.pop_back();
+    }
     if(return_stack.empty())
     {
         if(id != entrypoint) setError("return stack is empty");
@@ -700,7 +1601,12 @@ void Script::ret(const Value* v)
                 setError("can't return a nullptr");
                 return;
             }
-            if(!p->set(v->getP(), v->getType()))
+            if(owned && (v->getType() == INT || v->getType() == FLOAT || v->getType() == STR || v->getType() == ARRAY || v->getType() == DICT)) // the frame is cleared below anyway
+            {
+                if(!p->move(*v))
+                    setError("set(Value) error in ret(Value)");
+            }
+            else if(!p->share(v->getP(), v->getType()))
                 setError("set(Value) error in ret(Value)");
         }
     }
@@ -711,7 +1617,8 @@ void Script::ret(const Value* v)
         pc = f.pc;
         id = f.id;
         scope = f.scope;
-        ifstack = f.ifstack;
+        canElse = f.canElse;
+        ifstack.swap(f.ifstack);
         for(auto &i: currentVars) i.clear();
         for(auto &i: currentRegs) i.clear();
         currentVars.swap(f.vars);
@@ -720,19 +1627,14 @@ void Script::ret(const Value* v)
     }
 }
 
-bool Script::compile(const std::string& file, const std::string& output, const char &flag)
+// source text to tokens
+// it's a state machine fed one character at a time, so a source can be tokenized by pieces
+struct Tokenizer
 {
-    // source file
-    std::ifstream f(file, std::ios::in | std::ios::binary);
-    if(!f)
-        return false;
-
-    // used vars
     std::string buf; // to store strings
     bool isstr = false; // if true, we are passing a STR type
     bool escape = false; // next character is escaped
     int comment = 0; // commenting state
-    char c; // to store a character
 
     // test
     bool isnum = false;
@@ -740,115 +1642,142 @@ bool Script::compile(const std::string& file, const std::string& output, const c
     bool isfl = false;
     bool isgvar = false;
 
-    TokenIDList tokens; // list of tokens after parsing
-    Compiled code(20); // resulting code
+    void read(const char& c, TokenIDList& tokens);
+    bool end(TokenIDList& tokens); // flush the last token (false if the source ended in the middle of a comment)
+};
 
-    // parsing the source file
-    do
+void Tokenizer::read(const char& c, TokenIDList& tokens)
+{
+    // comment mode (triggered by the '/' char)
+    // comments are "ignored" and won't be parsed
+    if(comment == 1)
     {
-        f.read(&c, 1);
-        if(!f.good()) continue;
-
-        // comment mode (triggered by the '/' char)
-        // comments are "ignored" and won't be parsed
-        if(comment == 1)
+        if(c == '/') // single line comment
         {
-            if(c == '/') // single line comment
-            {
-                comment = 2;
-                continue;
-            }
-            else if(c == '*') // multi line comment
-            {
-                comment = 3;
-                continue;
-            }
-            // it wasn't a comment, continue normally
-            buf += '/';
+            comment = 2;
+            return;
+        }
+        else if(c == '*') // multi line comment
+        {
+            comment = 3;
+            return;
+        }
+        // it wasn't a comment, continue normally
+        buf += '/';
+        comment = 0;
+    }
+    else if(comment == 2) // single line
+    {
+        if(c == '\n') // over if we encounter the end of the line
             comment = 0;
+        return;
+    }
+    else if(comment > 2) // multi line (simple state machine to support nested comments)
+    {
+        switch((comment-3)%3)
+        {
+            case 0:
+                if(c == '*') comment += 1;
+                else if(c == '/') comment += 2;
+                return;
+            case 1:
+                if(c == '/') comment -= 4;
+                else if(c != '*') comment -= 1;
+                return;
+            case 2:
+                if(c == '*') comment += 1;
+                else if(c != '/') comment -= 2;
+                return;
         }
-        else if(comment == 2) // single line
+    }
+
+    // normal mode
+    // std::regex is terribly slow so we parse the tokens manually
+    // starting with non string tokens:
+    if(!isstr)
+    {
+        if(c == '/') // either a comment or the divide operator
         {
-            if(c == '\n') // over if we encounter the end of the line
-                comment = 0;
-            continue;
+            if(!buf.empty())
+            {
+                tokens.push_back(buf);
+                buf.clear();
+            }
+            comment = 1;
+            isnum = false;
+            iswd = false;
+            isfl = false;
+            isgvar = false;
         }
-        else if(comment > 2) // multi line (simple state machine to support nested comments)
+        else if(std::isspace(c)) // a whitespace separates the tokens
         {
-            switch((comment-3)%3)
+            if(!buf.empty())
             {
-                case 0:
-                    if(c == '*') comment += 1;
-                    else if(c == '/') comment += 2;
-                    continue;
-                case 1:
-                    if(c == '/') comment -= 4;
-                    else if(c != '*') comment -= 1;
-                    continue;
-                case 2:
-                    if(c == '*') comment += 1;
-                    else if(c != '/') comment -= 2;
-                    continue;
+                tokens.push_back(buf);
+                buf.clear();
             }
+            buf.clear();
+            isnum = false;
+            iswd = false;
+            isfl = false;
+            isgvar = false;
         }
-
-        // normal mode
-        // std::regex is terribly slow so we parse the tokens manually
-        // starting with non string tokens:
-        if(!isstr)
+        else if(std::isalpha(c) || c == '_') // character or _ (it has to be part of a keyword, function or variable)
         {
-            if(c == '/') // either a comment or the divide operator
+            if(isnum)
             {
                 if(!buf.empty())
                 {
                     tokens.push_back(buf);
                     buf.clear();
                 }
-                comment = 1;
+                buf.clear();
                 isnum = false;
-                iswd = false;
-                isfl = false;
-                isgvar = false;
             }
-            else if(std::isspace(c)) // a whitespace separates the tokens
+            else if(!iswd && !isgvar) // a global variable name goes on
             {
                 if(!buf.empty())
                 {
                     tokens.push_back(buf);
                     buf.clear();
                 }
+            }
+            buf += c;
+            iswd = true;
+            isfl = false;
+            isgvar = false;
+        }
+        else if(c == '@') // @ (global var name)
+        {
+            if(!buf.empty())
+            {
+                tokens.push_back(buf);
                 buf.clear();
-                isnum = false;
-                iswd = false;
-                isfl = false;
-                isgvar = false;
             }
-            else if(std::isalpha(c) || c == '_') // character or _ (it has to be part of a keyword, function or variable)
+            buf.clear();
+            buf += c;
+            isnum = false;
+            iswd = false;
+            isfl = false;
+            isgvar = true;
+        }
+        else if(c == '$') // $ (script var name, the letters that follow are appended)
+        {
+            if(!buf.empty())
             {
-                if(isnum)
-                {
-                    if(!buf.empty())
-                    {
-                        tokens.push_back(buf);
-                        buf.clear();
-                    }
-                    buf.clear();
-                    isnum = false;
-                }
-                else if(!iswd)
-                {
-                    if(!buf.empty())
-                    {
-                        tokens.push_back(buf);
-                        buf.clear();
-                    }
-                }
-                buf += c;
-                iswd = true;
-                isfl = false;
-                isgvar = false;
+                tokens.push_back(buf);
+                buf.clear();
             }
-            else if(c == '@') // @ (global var name)
+            buf.clear();
+            buf += c;
+            isnum = false;
+            iswd = true;
+            isfl = false;
+            isgvar = false;
+        }
+        else if(std::isdigit(c)) // digit (part of a keyword but not the first character, int or float)
+        {
+            if(!iswd && !isnum && !isgvar)
             {
                 if(!buf.empty())
                 {
@@ -856,49 +1785,18 @@ bool Script::compile(const std::string& file, const std::string& output, const c
                     buf.clear();
                 }
                 buf.clear();
-                buf += c;
-                isnum = false;
-                iswd = false;
+                isnum = true;
                 isfl = false;
-                isgvar = true;
-            }
-            else if(std::isdigit(c)) // digit (part of a keyword but not the first character, int or float)
-            {
-                if(!iswd && !isnum && !isgvar)
-                {
-                    if(!buf.empty())
-                    {
-                        tokens.push_back(buf);
-                        buf.clear();
-                    }
-                    buf.clear();
-                    isnum = true;
-                    isfl = false;
-                }
-                buf += c;
             }
-            else if(c == '.') // dot (only used in float). will trigger an error later if misused
+            buf += c;
+        }
+        else if(c == '.') // dot (only used in float). will trigger an error later if misused
+        {
+            if(!isfl && isnum)
             {
-                if(!isfl && isnum)
-                {
-                    isfl = true;
-                }
-                else
-                {
-                    if(!buf.empty())
-                    {
-                        tokens.push_back(buf);
-                        buf.clear();
-                    }
-                    buf.clear();
-                    iswd = false;
-                    isnum = false;
-                    isfl = false;
-                    isgvar = false;
-                }
-                buf += c;
+                isfl = true;
             }
-            else if(c == '"') // start of a string
+            else
             {
                 if(!buf.empty())
                 {
@@ -910,118 +1808,135 @@ bool Script::compile(const std::string& file, const std::string& output, const c
                 isnum = false;
                 isfl = false;
                 isgvar = false;
-                isstr = true; // enable string mode
-                buf += c;
             }
-            else if(c == '(' || c == '{' || c == ')' || c == '}' || c == ',' || c == ';') // various used character
+            buf += c;
+        }
+        else if(c == '"') // start of a string
+        {
+            if(!buf.empty())
             {
-                if(!buf.empty())
-                {
-                    tokens.push_back(buf);
-                    buf.clear();
-                }
-                buf += c;
-                isnum = false;
-                iswd = false;
-                isfl = false;
-                isgvar = false;
+                tokens.push_back(buf);
+                buf.clear();
             }
-            else if(c == '=') // equal operator
+            buf.clear();
+            iswd = false;
+            isnum = false;
+            isfl = false;
+            isgvar = false;
+            isstr = true; // enable string mode
+            buf += c;
+        }
+        else if(c == '(' || c == '{' || c == ')' || c == '}' || c == ',' || c == ';') // various used character
+        {
+            if(!buf.empty())
             {
-                if(!buf.empty())
-                {
-                    tokens.push_back(buf);
-                    buf.clear();
-                    buf += c;
-
-                    if(tokens.back().size() == 1) // we check if it follows directly one of these operator (example: += )
-                    {
-                        char d = tokens.back()[0];
-                        if(d == '+' || d == '-' || d == '*' || d == '/' || d == '%' || d == '<' || d == '=' || d == '>' || d == '!')
-                        {
-                            tokens.back() += c; // we concatenate if it's the case
-                            buf.clear();
-                        }
-                    }
-                }
-                else
-                {
-                    buf += c;
-                }
-                isnum = false;
-                iswd = false;
-                isfl = false;
-                isgvar = false;
+                tokens.push_back(buf);
+                buf.clear();
             }
-            else if(c == '+' || c == '-' || c == '&' || c == '^' || c == '|') // operators which can be doubled (example: ++ )
+            buf += c;
+            isnum = false;
+            iswd = false;
+            isfl = false;
+            isgvar = false;
+        }
+        else if(c == '=') // equal operator
+        {
+            if(!buf.empty())
             {
-                if(!buf.empty())
+                tokens.push_back(buf);
+                buf.clear();
+                buf += c;
+
+                if(tokens.back().size() == 1) // we check if it follows directly one of these operator (example: += )
                 {
-                    tokens.push_back(buf);
-                    buf.clear();
-                    buf += c;
-                    if(tokens.back() == buf)
+                    char d = tokens.back()[0];
+                    if(d == '+' || d == '-' || d == '*' || d == '/' || d == '%' || d == '<' || d == '=' || d == '>' || d == '!')
                     {
-                        tokens.back() += c;
+                        tokens.back() += c; // we concatenate if it's the case
                         buf.clear();
                     }
                 }
-                else
-                {
-                    buf += c;
-                }
-                isnum = false;
-                iswd = false;
-                isfl = false;
-                isgvar = false;
             }
-            else /*if(c == '<' || c == '>' || c == '*' || c == '%' || c == '!')*/ // other operators + any unexpected chars (those will trigger an error)
+            else
             {
-                if(!buf.empty())
-                {
-                    tokens.push_back(buf);
-                    buf.clear();
-                }
                 buf += c;
-                isnum = false;
-                iswd = false;
-                isfl = false;
-                isgvar = false;
             }
+            isnum = false;
+            iswd = false;
+            isfl = false;
+            isgvar = false;
         }
-        else // string mode
+        else if(c == '+' || c == '-' || c == '&' || c == '^' || c == '|') // operators which can be doubled (example: ++ )
         {
-            if(c == '\\' && !escape) // escape mode
-            {
-                escape = true;
-            }
-            else if(c == '"' && !escape) // end of string
+            if(!buf.empty())
             {
-                isstr = false;
-                buf += c; // we keep the ", we use it later to check if the token is a string
-                if(!buf.empty())
-                    tokens.push_back(buf);
+                tokens.push_back(buf);
                 buf.clear();
+                buf += c;
+                if(tokens.back() == buf)
+                {
+                    tokens.back() += c;
+                    buf.clear();
+                }
             }
-            else if(c == '\r') // used by windows, we skip
+            else
             {
-                continue;
+                buf += c;
             }
-            else if(c == '\n' && !escape) // unescaped end of line, we trigger an error for later, on purpose
+            isnum = false;
+            iswd = false;
+            isfl = false;
+            isgvar = false;
+        }
+        else /*if(c == '<' || c == '>' || c == '*' || c == '%' || c == '!')*/ // other operators + any unexpected chars (those will trigger an error)
+        {
+            if(!buf.empty())
             {
-                if(!buf.empty())
-                    tokens.push_back(buf);
+                tokens.push_back(buf);
                 buf.clear();
-                isstr = false;
-            }
-            else // everything else is saved
-            {
-                buf += c;
-                escape = false;
             }
+            buf += c;
+            isnum = false;
+            iswd = false;
+            isfl = false;
+            isgvar = false;
+        }
+    }
+    else // string mode
+    {
+        if(c == '\\' && !escape) // escape mode
+        {
+            escape = true;
+        }
+        else if(c == '"' && !escape) // end of string
+        {
+            isstr = false;
+            buf += c; // we keep the ", we use it later to check if the token is a string
+            if(!buf.empty())
+                tokens.push_back(buf);
+            buf.clear();
+        }
+        else if(c == '\r') // used by windows, we skip
+        {
+            return;
         }
-    }while(f.good());
+        else if(c == '\n' && !escape) // unescaped end of line, we trigger an error for later, on purpose
+        {
+            if(!buf.empty())
+                tokens.push_back(buf);
+            buf.clear();
+            isstr = false;
+        }
+        else // everything else is saved
+        {
+            buf += c;
+            escape = false;
+        }
+    }
+}
 
+bool Tokenizer::end(TokenIDList& tokens)
+{
     if(comment != 0 && comment != 2)
     {
         std::cout << "missing a '*/' ?" << std::endl;
@@ -1030,38 +1945,343 @@ bool Script::compile(const std::string& file, const std::string& output, const c
 
     if(!buf.empty())
         tokens.push_back(buf);
+    buf.clear();
+    return true;
+}
 
-    bool err = !shuntingyard(tokens, code); // apply a shunting yard algorithm (+ the formatting, error check and optimization)
+bool Script::compile(const std::string& file, const std::string& output, const char &flag, CompileStats* stats)
+{
+    PhaseStart start = phaseStart();
+    CompileStats local;
+    if(!stats && (flag & STATS)) stats = &local;
+    if(stats) *stats = CompileStats();
 
-    // check for anything weird
-    if(!err)
+    if(flag & STREAM)
+    {
+        if(!compileStream(file, output, flag & ~STATS, stats))
+            return false;
+        if(stats)
+        {
+            stats->time = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start.time).count();
+            if(flag & STATS) std::cout << stats->toJSON() << std::endl;
+        }
+        return true;
+    }
+
+    // source file
+    std::ifstream f(file, std::ios::in | std::ios::binary);
+    if(!f)
+        return false;
+    std::string source((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    f.close();
+
+    // compile cache: the same source compiled in the same environment gives the same file, we just copy it
+    std::string cached;
+    if(!compile_cache.empty() && !(flag & PRINT))
     {
-        switch(errorCheck(code))
+        cached = compile_cache + "/" + cacheKey(source) + ".csr";
+        if(copyFile(cached, output))
         {
-            case 0: break;
-            case 1: std::cout << "op isn't of type FUNC or OPERATOR" << std::endl; err = true; break;
-            case 2: std::cout << "parameter must be a value or variable" << std::endl; err = true; break;
-            case 3: std::cout << "unknown function call" << std::endl; err = true; break;
-            case 4: std::cout << "mismatched number of parameters" << std::endl; err = true; break;
+            if(stats)
+            {
+                stats->cached = true;
+                stats->time = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start.time).count();
+                if(flag & STATS) std::cout << stats->toJSON() << std::endl;
+            }
+            return true;
         }
     }
 
-    if(!err && !postprocessing(code))
+    std::vector<char> program;
+    if(!compileFromString(source, program, flag & ~STATS, stats))
+        return false;
+
+    if(!writeFile(output, program))
     {
-        err = true;
-        std::cout << "postprocessing failed" << std::endl;
+        std::cout << "writing to " << output << " failed" << std::endl;
+        return false;
     }
 
+    // populate the cache (written under a temporary name then renamed, so a concurrent reader never sees a partial file)
+    if(!cached.empty())
+    {
+        std::string tmp = tempName(cached, ".tmp");
+        if(!writeFile(tmp, program) || std::rename(tmp.c_str(), cached.c_str()) != 0)
+            std::remove(tmp.c_str());
+    }
+
+    if(stats)
+    {
+        stats->time = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start.time).count();
+        if(flag & STATS) std::cout << stats->toJSON() << std::endl;
+    }
+    return true;
+}
+
+bool Script::compileFromString(const std::string& source, std::vector<char>& program, const char &flag, CompileStats* stats)
+{
+    CompileStats local;
+    if(!stats && (flag & STATS)) stats = &local;
+    if(stats) *stats = CompileStats();
+    TokenCounting counting(stats != nullptr);
+    PhaseStart total = phaseStart();
+    PhaseStart start = total;
+
+    Tokenizer tokenizer;
+    TokenIDList tokens; // list of tokens after parsing
+    Compiled code(20); // resulting code
+
+    // parsing the source file
+    for(auto &c: source)
+        tokenizer.read(c, tokens);
+    if(!tokenizer.end(tokens))
+        return false;
+    phaseEnd(stats, CompileStats::TOKENIZE, start, tokens.size(), 0);
+
+    ThreadPool pool(threadCount(flag));
+    bool err = !shuntingyard(tokens, code, pool, stats); // apply a shunting yard algorithm (+ the formatting, error check and optimization)
+    if(!err)
+        err = !process(code, pool, stats);
+
     if(!err && (flag & PRINT))
         print(code);
 
-    if(!err && !save(output, code))
+    if(!err)
+    {
+        start = phaseStart();
+        std::ostringstream o(std::ios::out | std::ios::binary);
+        if(save(o, code))
+        {
+            const std::string& str = o.str();
+            program.assign(str.begin(), str.end());
+        }
+        else
+        {
+            err = true;
+            std::cout << "saving failed" << std::endl;
+        }
+        if(stats) phaseEnd(stats, CompileStats::SAVE, start, countTokens(code), countInstructions(code));
+    }
+
+    freeCode(code);
+
+    if(stats)
+    {
+        stats->time = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - total.time).count();
+        if(flag & STATS) std::cout << stats->toJSON() << std::endl;
+    }
+
+    return !err;
+}
+
+bool Script::compileStream(const std::string& file, const std::string& output, const char &flag, CompileStats* stats)
+{
+    TokenCounting counting(stats != nullptr);
+    std::ifstream f(file, std::ios::in | std::ios::binary);
+    if(!f)
+        return false;
+
+    // the main function and the other function bodies are written to temporary files as soon as they are compiled
+    // they are merged behind the function table at the end
+    const std::string mainFile = tempName(output, ".main.tmp");
+    const std::string funcFile = tempName(output, ".func.tmp");
+    std::ofstream mainOut(mainFile, std::ios::out | std::ios::trunc | std::ios::binary);
+    std::ofstream funcOut(funcFile, std::ios::out | std::ios::trunc | std::ios::binary);
+    if(!mainOut || !funcOut)
+    {
+        mainOut.close();
+        funcOut.close();
+        std::remove(mainFile.c_str());
+        std::remove(funcFile.c_str());
+        return false;
+    }
+
+    ThreadPool pool(threadCount(flag)); // shared by all the chunks
+    Tokenizer tokenizer;
+    TokenIDList tokens; // tokens of the current top level statement or function definition
+    Compiled known(20); // already compiled functions (no code, only what's needed to check the calls)
+    std::vector<std::pair<std::string, size_t> > table = {{"", 0}}; // function table, main first
+    size_t mainLines = 0; // line count of the main function
+    size_t depth = 0; // { } depth
+    size_t paren = 0; // ( ) depth
+    size_t cut = 0; // if not 0, number of tokens forming a complete top level statement
+    size_t checked = 0; // number of tokens already checked for a cut
+    std::vector<char> buffer(1 << 16);
+    bool eof = false;
+    bool err = false;
+    PhaseStart start;
+    known[""];
+
+    while(!err && !eof)
+    {
+        start = phaseStart();
+        f.read(buffer.data(), buffer.size());
+        size_t n = f.gcount();
+        for(size_t i = 0; i < n; ++i)
+            tokenizer.read(buffer[i], tokens);
+        if(!f.good())
+        {
+            eof = true;
+            if(!tokenizer.end(tokens))
+            {
+                err = true;
+                break;
+            }
+        }
+        phaseEnd(stats, CompileStats::TOKENIZE, start, tokens.size(), 0);
+
+        // compile each complete top level statement or definition as soon as it's over
+        for(; !err && checked < tokens.size(); ++checked)
+        {
+            if(cut) // an if/elif/else chain is kept in one piece
+            {
+                if(tokens[checked] != "elif" && tokens[checked] != "else")
+                {
+                    err = !compileChunk(TokenIDList(tokens.begin(), tokens.begin()+cut), known, table, mainOut, funcOut, mainLines, pool, stats);
+                    tokens.erase(tokens.begin(), tokens.begin()+cut);
+                    checked -= cut;
+                }
+                cut = 0;
+            }
+            const std::string& t = tokens[checked];
+            if(t == "(") ++paren;
+            else if(t == ")") { if(paren) --paren; }
+            else if(t == "{") ++depth;
+            else if(t == "}")
+            {
+                if(depth) --depth;
+                if(depth == 0) cut = checked + 1;
+            }
+            else if(t == ";" && depth == 0 && paren == 0) cut = checked + 1; // not in a for loop header
+        }
+    }
+    if(!err && !tokens.empty())
+        err = !compileChunk(tokens, known, table, mainOut, funcOut, mainLines, pool, stats);
+    mainOut.close();
+    funcOut.close();
+
+    // final file: header, main function, then the others
+    if(!err)
+    {
+        start = phaseStart();
+        std::ofstream o(output, std::ios::out | std::ios::trunc | std::ios::binary);
+        std::ifstream mainIn(mainFile, std::ios::in | std::ios::binary);
+        std::ifstream funcIn(funcFile, std::ios::in | std::ios::binary);
+        if(o && mainIn && funcIn)
+        {
+            const Code& main = known[""];
+            saveHeader(o, table, main.svar.size());
+            size_t tmp = main.creg;
+            o.write((char*)&tmp, 4);
+            tmp = main.var.size();
+            o.write((char*)&tmp, 4);
+            tmp = 0; // flags
+            o.write((char*)&tmp, 4);
+            tmp = mainLines;
+            o.write((char*)&tmp, 4);
+            if(mainLines) o << mainIn.rdbuf();
+            if(table.size() > 1) o << funcIn.rdbuf();
+        }
+        if(!o.good())
+        {
+            err = true;
+            std::cout << "writing to " << output << " failed" << std::endl;
+        }
+        phaseEnd(stats, CompileStats::SAVE, start, 0, 0);
+    }
+    std::remove(mainFile.c_str());
+    std::remove(funcFile.c_str());
+    return !err;
+}
+
+bool Script::compileChunk(const TokenIDList& tokens, Compiled& known, std::vector<std::pair<std::string, size_t> >& table, std::ostream& mainOut, std::ostream& funcOut, size_t &mainLines, ThreadPool& pool, CompileStats* stats)
+{
+    // the chunk is compiled with empty copies of the known functions it refers to
+    Compiled code(20);
+    for(auto &t: tokens)
+    {
+        auto xi = known.find(t);
+        if(xi != known.end() && !t.empty())
+        {
+            code[t].argn = xi->second.argn;
+            code[t].globalWrites = xi->second.globalWrites;
+            code[t].scriptWrites = xi->second.scriptWrites;
+            code[t].pure = xi->second.pure;
+            code[t].anyGlobalWrite = xi->second.anyGlobalWrite;
+        }
+    }
+    Code& main = code[""];
+    main.var = known[""].var; // the main variables keep their ids from a chunk to another
+    main.svar = known[""].svar; // and so do the script variables
+    main.partial = true;
+
+    bool err = !shuntingyard(tokens, code, pool, stats);
+    if(!err)
+        err = !process(code, pool, stats);
+
+    if(!err)
+    {
+        PhaseStart start = phaseStart();
+        for(auto &xi: code)
+        {
+            if(xi.first.empty())
+            {
+                Code& m = known[""];
+                m.var = xi.second.var;
+                m.svar = xi.second.svar;
+                m.creg = std::max(m.creg, xi.second.creg);
+                saveLines(mainOut, xi.second.line);
+                mainLines += xi.second.line.size();
+            }
+            else if(known.find(xi.first) == known.end()) // new function
+            {
+                known[xi.first].argn = xi.second.argn;
+                known[xi.first].globalWrites = xi.second.globalWrites;
+                known[xi.first].scriptWrites = xi.second.scriptWrites;
+                known[xi.first].pure = xi.second.pure;
+                known[xi.first].anyGlobalWrite = xi.second.anyGlobalWrite;
+                table.push_back({xi.first, xi.second.argn});
+                saveFunction(funcOut, xi.second);
+            }
+        }
+        if(!mainOut.good() || !funcOut.good())
+            err = true;
+        phaseEnd(stats, CompileStats::SAVE, start, countTokens(code), countInstructions(code));
+    }
+
+    freeCode(code);
+    return !err;
+}
+
+bool Script::process(Compiled& code, ThreadPool& pool, CompileStats* stats)
+{
+    // check for anything weird
+    PhaseStart start = phaseStart();
+    bool err = true;
+    switch(errorCheck(code, pool))
+    {
+        case 0: err = false; break;
+        case 1: std::cout << "op isn't of type FUNC or OPERATOR" << std::endl; break;
+        case 2: std::cout << "parameter must be a value or variable" << std::endl; break;
+        case 3: std::cout << "unknown function call" << std::endl; break;
+        case 4: std::cout << "mismatched number of parameters" << std::endl; break;
+    }
+    if(stats) phaseEnd(stats, CompileStats::ERRORCHECK, start, countTokens(code), countInstructions(code));
+    if(err)
+        return false;
+
+    start = phaseStart();
+    if(!postprocessing(code, pool))
     {
+        std::cout << "postprocessing failed" << std::endl;
         err = true;
-        std::cout << "writing to " << output << " failed" << std::endl;
     }
+    if(stats) phaseEnd(stats, CompileStats::POSTPROCESSING, start, countTokens(code), countInstructions(code));
+    return !err;
+}
 
-    // free memory
+void Script::freeCode(Compiled& code)
+{
     for(auto &xi: code)
     {
         for(auto &xj: xi.second.line)
@@ -1070,18 +2290,82 @@ bool Script::compile(const std::string& file, const std::string& output, const c
             for(auto &xk: xj.params)
                 delete xk;
         }
+        xi.second.line.clear();
     }
-
-    return !err;
 }
 
 static const std::unordered_map<std::string, int> have_operand_map = {
 {"++", 0}, {"--", 0}, {")", 1}, {",", 2}, {"=", 3}, {"+", 3}, {"-", 3}, {"*", 3}, {"/", 3}, {"!=", 3},
 {">", 3}, {"<", 3}, {"<=", 3}, {">=", 3}, {"!=", 3}, {"==", 3}, {"&", 3}, {"^", 3}, {"|", 3}, {"&&", 3},
-{"||", 3}, {"^^", 3}, {"+=", 3}, {"-=", 3}, {"*=", 3}, {"/=", 3}, {"%", 3}, {"%=", 3}, {"{", 4} , {";", 5}
+{"||", 3}, {"^^", 3}, {"+=", 3}, {"-=", 3}, {"*=", 3}, {"/=", 3}, {"%", 3}, {"%=", 3}, {"{", 4} , {";", 5}, {"[", 6}, {"]", 7}
 };
-bool Script::shuntingyard(const TokenIDList& tokens, Compiled& code)
+// for(init; condition; step) { ... } becomes init; while(condition) { ... step; }
+static bool lowerForLoops(const TokenIDList& tokens, TokenIDList& out)
+{
+    std::vector<std::pair<size_t, TokenIDList> > steps; // { } depth of the open loop bodies and their step
+    size_t depth = 0;
+    for(size_t i = 0; i < tokens.size(); ++i)
+    {
+        if(tokens[i] == "for" && i+1 < tokens.size() && tokens[i+1] == "(")
+        {
+            TokenIDList part[3]; // init, condition, step
+            size_t k = 0;
+            size_t paren = 0;
+            for(i += 2; i < tokens.size(); ++i)
+            {
+                const std::string& t = tokens[i];
+                if(t == "(") ++paren;
+                else if(t == ")")
+                {
+                    if(paren == 0) break;
+                    --paren;
+                }
+                else if(t == ";" && paren == 0)
+                {
+                    if(++k > 2) return false;
+                    continue;
+                }
+                part[k].push_back(t);
+            }
+            if(k != 2 || part[1].empty() || i+1 >= tokens.size() || tokens[i+1] != "{")
+                return false;
+            ++i;
+            out.insert(out.end(), part[0].begin(), part[0].end());
+            out.push_back(";");
+            out.push_back("while");
+            out.push_back("(");
+            out.insert(out.end(), part[1].begin(), part[1].end());
+            out.push_back(")");
+            out.push_back("{");
+            steps.push_back({++depth, part[2]});
+            continue;
+        }
+        if(tokens[i] == "{") ++depth;
+        else if(tokens[i] == "}")
+        {
+            if(!steps.empty() && steps.back().first == depth) // the step is the last line of the body
+            {
+                out.insert(out.end(), steps.back().second.begin(), steps.back().second.end());
+                out.push_back(";");
+                steps.pop_back();
+            }
+            if(depth) --depth;
+        }
+        out.push_back(tokens[i]);
+    }
+    return steps.empty();
+}
+
+bool Script::shuntingyard(const TokenIDList& source, Compiled& code, ThreadPool& pool, CompileStats* stats)
 {
+    PhaseStart start = phaseStart();
+    TokenIDList lowered;
+    if(std::find(source.begin(), source.end(), "for") != source.end() && !lowerForLoops(source, lowered))
+    {
+        std::cout << "malformed for loop" << std::endl;
+        return false;
+    }
+    const TokenIDList& tokens = (lowered.empty() ? source : lowered);
     // vars
     Program prog(20); // will contain the code in RPN
     VariableList vars(20); // variable names used by the code
@@ -1150,7 +2434,7 @@ want_operand:
     {
         if(stack.empty()) goto sy_empty_stack;
         tk = stack.top();
-        if(tk->t != LBRK) goto sy_error;
+        if(tk->t != LBRK || tk->s != "(") goto sy_error;
         delete tk;
         stack.pop();
         ++it;
@@ -1165,7 +2449,14 @@ want_operand:
             case 1: output.push_back(new Token(*it, INT)); break;
             case 2: output.push_back(new Token(*it, FLOAT)); break;
             case 3:
-                if(!isFunction(*it, code)) // var
+                if(!isCall(it, tokens.cend(), code) && gl_const.count(*it)) // host constant, replaced by its value
+                {
+                    if((it + 1 != tokens.cend() && isAssignmentOp(*(it + 1))) || (!stack.empty() && stack.top()->o == PREFIX && isAssignmentOp(stack.top()->s)))
+                        goto sy_const_error;
+                    const auto &c = gl_const.find(*it)->second;
+                    output.push_back(new Token(c.first, c.second));
+                }
+                else if(!isCall(it, tokens.cend(), code)) // var
                 {
                     output.push_back(new Token(*it, VAR));
                     if(vars[last_def].find(*it) == vars[last_def].end())
@@ -1187,11 +2478,27 @@ want_operand:
             case 4:
             {
                 std::string buf = it->substr(1);
-                if(std::stoul(buf) >= globalVars.size())
+                if(!std::isdigit(buf[0])) // named
+                {
+                    auto gv = gl_var.find(buf);
+                    if(gv == gl_var.end())
+                        goto sy_gvar_error;
+                    buf = std::to_string(gv->second);
+                }
+                else if(std::stoul(buf) >= globalVars.size())
                     goto sy_gvar_error;
                 output.push_back(new Token(buf, GVAR));
                 break;
             }
+            case 5: // the slot of a script variable is its rank of first appearance
+            {
+                auto &svar = code[""].svar;
+                size_t slot = std::find(svar.begin(), svar.end(), *it) - svar.begin();
+                if(slot == svar.size())
+                    svar.push_back(*it);
+                output.push_back(new Token(std::to_string(slot), SVAR));
+                break;
+            }
             default:
                 goto sy_error; // anything else is an error
         }
@@ -1202,9 +2509,11 @@ want_operand:
 function_def: // definition of a new function
     {
         if(it == tokens.cend()) goto sy_error; // eof
-        if(!isName(*it) || isNewFunction(*it, bank) || *it == "def") // check if the function name is valid
+        bool memo = (*it == "memo" && it+1 != tokens.cend() && *(it+1) != "("); // def memo name(...)
+        if(memo && ++it == tokens.cend()) goto sy_error;
+        if(!isName(*it) || isNewFunction(*it, bank) || code.find(*it) != code.end() || *it == "def" || *it == "for" || gl_const.count(*it)) // check if the function name is valid
             goto sy_def_error;
-        code[*it];
+        code[*it].memo = memo;
         bank.insert(*it);
         auto &cdef = code[*it].argn; // register it with a parameter count of zero (for now)
         prog[*it]; // create the needed stuff
@@ -1219,7 +2528,7 @@ function_def: // definition of a new function
         if(*it == ")") goto def_end; // if ), we are already done
 
         def_args:
-            if(isName(*it) && !isFunction(*it, code)) // expect a var name
+            if(isName(*it) && (!isFunction(*it, code) || gl_builtin.count(*it)) && !gl_const.count(*it)) // expect a var name
             {
                 ++cdef;
                 if(cvars.find(*it) != cvars.end())
@@ -1269,7 +2578,7 @@ have_operand: // explicit
                 if(!output.empty())
                 {
                     tk = output.back();
-                    if(tk->t == VAR)
+                    if(tk->t == VAR || tk->t == GVAR || tk->t == SVAR || (tk->t == OPERATOR && tk->s == "[]")) // a variable or an array element
                     {
                         output.push_back(new Token(*it, OPERATOR, POSTFIX));
                         ++it;
@@ -1291,6 +2600,7 @@ have_operand: // explicit
                     if(stack.empty()) goto sy_empty_stack;
                     tk = stack.top();
                 }
+                if(tk->s != "(") goto sy_error;
                 delete tk;
                 stack.pop();
                 ++it;
@@ -1307,6 +2617,7 @@ have_operand: // explicit
                     if(stack.empty()) goto sy_empty_stack;
                     tk = stack.top();
                 }
+                if(tk->s != "(") goto sy_error;
                 ++it;
                 goto want_operand;
             }
@@ -1362,17 +2673,59 @@ have_operand: // explicit
                 output.clear();
                 goto line_start;
             }
-            default: goto sy_error;
-        }
-    }
-ended:
-    //we are done
-    //debug(prog);
-    if(!format(prog, vars, code)) // convert RPN to something easier to process
-    {
+            case 6: // array index [ (applies to the last operand)
+            {
+                while(!stack.empty() && stack.top()->t == FUNC) // the last operand is a function call: f(x)[i]
+                {
+                    output.push_back(stack.top());
+                    stack.pop();
+                }
+                stack.push(new Token("[]", OPERATOR, INFIX));
+                stack.push(new Token(*it, LBRK));
+                ++it;
+                goto want_operand;
+            }
+            case 7: // array index ]
+            {
+                if(stack.empty()) goto sy_empty_stack;
+                tk = stack.top();
+                while(tk->t != LBRK)
+                {
+                    output.push_back(tk);
+                    stack.pop();
+                    if(stack.empty()) goto sy_empty_stack;
+                    tk = stack.top();
+                }
+                if(tk->s != "[") goto sy_error;
+                delete tk;
+                stack.pop();
+                if(stack.empty()) goto sy_empty_stack;
+                output.push_back(stack.top()); // the [] operator
+                stack.pop();
+                ++it;
+                goto have_operand;
+            }
+            default: goto sy_error;
+        }
+    }
+ended:
+    //we are done
+    //debug(prog);
+    if(stats)
+    {
+        size_t n = 0;
+        for(auto& i: prog)
+            for(auto& j: i.second)
+                n += j.size();
+        phaseEnd(stats, CompileStats::SHUNTINGYARD, start, n, 0);
+        start = phaseStart();
+    }
+    if(!format(prog, vars, code, pool)) // convert RPN to something easier to process
+    {
         std::cout << "Conversion error" << std::endl;
         goto sy_pp_error;
     }
+    if(stats) phaseEnd(stats, CompileStats::FORMAT, start, countTokens(code), countInstructions(code));
 
     ret = true;
     goto sy_end;
@@ -1382,6 +2735,10 @@ sy_def_error:
     std::cout << "def error" << std::endl;
     goto sy_end_error;
 
+sy_const_error:
+    std::cout << "constant can't be modified: " << *it << std::endl;
+    goto sy_end_error;
+
 sy_empty_stack:
     std::cout << "stack error" << std::endl;
     goto sy_end_error;
@@ -1391,7 +2748,7 @@ sy_pp_error:
     goto sy_end_error;
 
 sy_gvar_error:
-    std::cout << "invalid global variable id" << std::endl;
+    std::cout << "invalid global variable id or name: " << *it << std::endl;
     goto sy_end_error;
 
 sy_error:
@@ -1419,178 +2776,330 @@ sy_end:
     return ret;
 }
 
-bool Script::format(Program &prog, VariableList &vars, Compiled& code)
+// the "[]" of the instructions [first, end) which loaded the register r (SIZE_MAX if r was written by something else)
+static size_t findLoad(const std::vector<Instruction>& ins, const size_t& first, const size_t& end, Token* r)
 {
-    std::vector<Instruction> postfixes;
-    for(auto &xi: prog)
+    if(r->t != RESULT) return SIZE_MAX;
+    for(size_t k = end; k-- > first;)
+        if(ins[k].hasResult && *(ins[k].params.back()) == *r)
+            return (ins[k].op->t == OPERATOR && ins[k].op->s == "[]") ? k : SIZE_MAX;
+    return SIZE_MAX;
+}
+
+// "[]=" storing the register r in the element loaded by ins[load] (with a result register if res isn't nullptr)
+static Instruction storeInstruction(const Instruction& load, Token* r, Token* res)
+{
+    Instruction st;
+    st.op = new Token("[]=", OPERATOR, INFIX);
+    st.params = {new Token(*load.params[0]), new Token(*load.params[1]), new Token(*r)};
+    if(res)
+    {
+        st.params.push_back(res);
+        st.hasResult = true;
+    }
+    return st;
+}
+
+// a[i][j] = v changes a copy of a[i] in a register, which is then stored back in a (and so on)
+static void storeContainers(const std::vector<Instruction>& ins, const size_t& first, Token* c, std::vector<Instruction>& out)
+{
+    size_t k;
+    while((k = findLoad(ins, first, ins.size(), c)) != SIZE_MAX)
+    {
+        out.push_back(storeInstruction(ins[k], c, nullptr));
+        c = ins[k].params[0];
+    }
+}
+
+// free register of a line being formatted
+static size_t reserveRegister(std::vector<bool>& regs)
+{
+    size_t r = 0;
+    for(; r < regs.size(); ++r)
+        if(regs[r] == false)
+            break;
+    if(r == regs.size())
+        regs.push_back(false);
+    regs[r] = true;
+    return r;
+}
+
+bool Script::format(Program &prog, VariableList &vars, Compiled& code, ThreadPool& pool)
+{
+    // each function is converted independently
+    bool ok = forEachFunction(code, pool, [&prog, &vars, &code](const std::string& name, Code& func) -> int
     {
-        for(auto xj: vars[xi.first])
-            code[xi.first].var.push_back(xj);
-        vars[xi.first].clear();
+        auto xi = prog.find(name);
+        auto xv = vars.find(name);
+        if(xi == prog.end() || xv == vars.end()) return 0; // nothing new in this function (streaming mode)
+        return formatFunction(xi->second, xv->second, func, code) ? 0 : 1;
+    }) == 0;
 
-        size_t j;
-        for(auto &xj: xi.second)
+    if(!ok)
+    {
+        for(auto &xi: code)
         {
-            // if markers { and } are directly processed
-            if(xj.size() == 1 && (xj[0]->t == LCUR || xj[0]->t == RCUR))
-            {
-                Instruction ins;
-                ins.op = xj[0];
-                code[xi.first].line.push_back(ins);
+            for(auto &xj: xi.second.line)
                 xj.clear();
-                continue;
-            }
-            // and single token lines are ignored (excluding functions)
-            else if(xj.size() == 1 && xj[0]->t != FUNC)
+        }
+        code.clear();
+    }
+    return ok;
+}
+
+bool Script::formatFunction(TokenList &lines, std::set<std::string> &vars, Code& func, const Compiled& code)
+{
+    std::vector<Instruction> postfixes;
+    for(auto xj: vars)
+        if(std::find(func.var.begin(), func.var.end(), xj) == func.var.end())
+            func.var.push_back(xj);
+    vars.clear();
+
+    size_t j;
+    for(auto &xj: lines)
+    {
+        // if markers { and } are directly processed
+        if(xj.size() == 1 && (xj[0]->t == LCUR || xj[0]->t == RCUR))
+        {
+            Instruction ins;
+            ins.op = xj[0];
+            func.line.push_back(ins);
+            xj.clear();
+            continue;
+        }
+        // and single token lines are ignored (excluding functions)
+        else if(xj.size() == 1 && xj[0]->t != FUNC)
+        {
+            continue;
+        }
+        // processing the RPN line
+        #warning "maybe switch to reverse order later"
+        std::vector<bool> regs; // track temporary variable uses
+        size_t first = func.line.size(); // first instruction of the line
+        for(size_t i = 0; i < xj.size(); ++i) // go through tokens
+        {
+            // until we find an operator or function call
+            if(xj[i]->t == OPERATOR)
             {
-                continue;
+                if(isSingleOp(xj[i]->s) || (xj[i]->s == "-" && xj[i]->o == PREFIX))
+                    j = i - 1;
+                else j = i - 2;
             }
-            // processing the RPN line
-            #warning "maybe switch to reverse order later"
-            std::vector<bool> regs; // track temporary variable uses
-            for(size_t i = 0; i < xj.size(); ++i) // go through tokens
+            else if(xj[i]->t == FUNC)
             {
-                // until we find an operator or function call
-                if(xj[i]->t == OPERATOR)
-                {
-                    if(isSingleOp(xj[i]->s) || (xj[i]->s == "-" && xj[i]->o == PREFIX))
-                        j = i - 1;
-                    else j = i - 2;
-                }
-                else if(xj[i]->t == FUNC)
+                auto ast = code.find(xj[i]->s);
+                if(ast != code.end())
+                    j = i - ast->second.argn;
+                else
                 {
-                    auto ast = code.find(xj[i]->s);
-                    if(ast != code.end())
-                        j = i - ast->second.argn;
-                    else
-                    {
-                        auto bst = gl_func.find(xj[i]->s);
-                        if(bst != gl_func.end())
-                            j = i - bst->second;
-                        else goto fc_misf_error;
-                    }
+                    auto bst = gl_func.find(xj[i]->s);
+                    if(bst != gl_func.end())
+                        j = i - bst->second;
+                    else goto fc_misf_error;
                 }
-                else continue; // else, next token
-                if(j < 0) goto fc_argn_error;
+            }
+            else continue; // else, next token
+            if(j < 0) goto fc_argn_error;
 
-                // j contains the position of the first parameter needed by the function/operator
+            // j contains the position of the first parameter needed by the function/operator
 
-                // create the instruction
-                Instruction ins;
-                ins.op = xj[i]; // function/operator
+            // create the instruction
+            Instruction ins;
+            ins.op = xj[i]; // function/operator
 
-                switch(ins.op->o)
-                {
-                    case POSTFIX: // ++ --
-                        if(j != i - 1) goto fc_error;
-                        switch(xj[j]->t)
+            switch(ins.op->o)
+            {
+                case POSTFIX: // ++ --
+                    if(j != i - 1) goto fc_error;
+                    switch(xj[j]->t)
+                    {
+                        case RESULT:
+                            regs[xj[j]->getInt()] = false; // nobreak
+                        case INT: case FLOAT: case STR: case VAR: case GVAR: case SVAR:
+                            ins.params.push_back(new Token(*xj[j]));
+                            break;
+                        default:
+                            goto fc_para_error;
+                            break;
+                    }
+                    {
+                        size_t k = findLoad(func.line, first, func.line.size(), ins.params[0]);
+                        if(k != SIZE_MAX) // a[i]++: the element is loaded again at the end of the line, changed and stored back
                         {
-                            case RESULT:
-                                regs[xj[j]->getInt()] = false; // nobreak
-                            case INT: case FLOAT: case STR: case VAR: case GVAR:
-                                ins.params.push_back(new Token(*xj[j]));
-                                break;
-                            default:
-                                goto fc_para_error;
-                                break;
+                            Token* r = new Token(std::to_string(reserveRegister(regs)), RESULT);
+                            Instruction ld;
+                            ld.op = new Token("[]", OPERATOR, INFIX);
+                            ld.params = {new Token(*func.line[k].params[0]), new Token(*func.line[k].params[1]), r};
+                            ld.hasResult = true;
+                            postfixes.push_back(ld);
+                            ins.params[0]->s = r->s;
+                            postfixes.push_back(ins);
+                            postfixes.push_back(storeInstruction(func.line[k], r, nullptr));
+                            storeContainers(func.line, first, func.line[k].params[0], postfixes);
                         }
-                        postfixes.push_back(ins);
-                        xj.erase(xj.begin()+i); // remove the used tokens from the RPN lines
-                        --i;
-                        break;
-                    case PREFIX: // - ! ++ --
-                        if(j != i - 1) goto fc_argn_error;
-                        switch(xj[j]->t)
+                        else postfixes.push_back(ins);
+                    }
+                    xj.erase(xj.begin()+i); // remove the used tokens from the RPN lines
+                    --i;
+                    break;
+                case PREFIX: // - ! ++ --
+                    if(j != i - 1) goto fc_argn_error;
+                    switch(xj[j]->t)
+                    {
+                        case RESULT:
+                            regs[xj[j]->getInt()] = false; // nobreak
+                        case INT: case FLOAT: case STR: case VAR: case GVAR: case SVAR:
+                            ins.params.push_back(new Token(*xj[j]));
+                            break;
+                        default:
+                            goto fc_para_error;
+                            break;
+                    }
+                    switch(op_unordered_map.at(ins.op->s))
+                    {
+                        case 5: case 2: // ! -
                         {
-                            case RESULT:
-                                regs[xj[j]->getInt()] = false; // nobreak
-                            case INT: case FLOAT: case STR: case VAR: case GVAR:
-                                ins.params.push_back(new Token(*xj[j]));
-                                break;
-                            default:
-                                goto fc_para_error;
-                                break;
+                            // search a free tmp variable (to store the result)
+                            size_t r = 0;
+                            for(; r < regs.size(); ++r)
+                                if(regs[r] == false)
+                                    break;
+                            if(r == regs.size()) // create a new one if none
+                                regs.push_back(false);
+                            regs[r] = true; // mark the temp variable as non free
+                            ins.params.push_back(new Token(std::to_string(r), RESULT)); // add the temp variable as an extra parameter
+                            ins.hasResult = true;
+                            func.line.push_back(ins); // store the instruction
+                            xj.erase(xj.begin()+j, xj.begin()+i); // remove the used tokens from the RPN lines
+                            xj[j] = new Token(std::to_string(r), RESULT); // place the temp variable where the used tokens were
+                            i = j;
+                            break;
                         }
-                        switch(op_unordered_map.at(ins.op->s))
+                        case 18: case 19: // ++ --
                         {
-                            case 5: case 2: // ! -
+                            func.line.push_back(ins);
+                            size_t k = findLoad(func.line, first, func.line.size()-1, ins.params[0]);
+                            if(k != SIZE_MAX) // ++a[i]: the element is stored back, the line continues with the stored value
                             {
-                                // search a free tmp variable (to store the result)
-                                size_t r = 0;
-                                for(; r < regs.size(); ++r)
-                                    if(regs[r] == false)
-                                        break;
-                                if(r == regs.size()) // create a new one if none
-                                    regs.push_back(false);
-                                regs[r] = true; // mark the temp variable as non free
-                                ins.params.push_back(new Token(std::to_string(r), RESULT)); // add the temp variable as an extra parameter
-                                ins.hasResult = true;
-                                code[xi.first].line.push_back(ins); // store the instruction
-                                xj.erase(xj.begin()+j, xj.begin()+i); // remove the used tokens from the RPN lines
-                                xj[j] = new Token(std::to_string(r), RESULT); // place the temp variable where the used tokens were
-                                i = j;
-                                break;
+                                size_t r = reserveRegister(regs);
+                                func.line.push_back(storeInstruction(func.line[k], ins.params[0], new Token(std::to_string(r), RESULT)));
+                                storeContainers(func.line, first, func.line[k].params[0], func.line);
+                                delete xj[j];
+                                xj[j] = new Token(std::to_string(r), RESULT);
                             }
-                            case 18: case 19: // ++ --
-                                code[xi.first].line.push_back(ins);
-                                xj.erase(xj.begin()+i); // remove the used tokens from the RPN lines
-                                --i;
-                                break;
-                            default: ins.op = nullptr; ins.clear(); goto fc_op_error;
+                            xj.erase(xj.begin()+i); // remove the used tokens from the RPN lines
+                            --i;
+                            break;
                         }
-                        break;
-                    default: // everything else
-                    {
-                        if(j >= 0) // store the parameters if any
-                            for(size_t k = j; k < i; ++k)
+                        default: ins.op = nullptr; ins.clear(); goto fc_op_error;
+                    }
+                    break;
+                default: // everything else
+                {
+                    bool load = (ins.op->t == OPERATOR && ins.op->s == "[]");
+                    if(j >= 0) // store the parameters if any
+                        for(size_t k = j; k < i; ++k)
+                        {
+                            switch(xj[k]->t)
                             {
-                                switch(xj[k]->t)
-                                {
-                                    case RESULT:
+                                case RESULT:
+                                    if(!load) // the operands of a load stay reserved, the element may be stored back
                                         regs[xj[k]->getInt()] = false; // nobreak
-                                    case INT: case FLOAT: case STR: case VAR: case GVAR:
-                                        ins.params.push_back(xj[k]);
-                                        break;
-                                    default:
-                                        goto fc_para_error;
-                                        break;
-                                }
+                                case INT: case FLOAT: case STR: case VAR: case GVAR: case SVAR:
+                                    ins.params.push_back(xj[k]);
+                                    break;
+                                default:
+                                    goto fc_para_error;
+                                    break;
                             }
-                        // search a free tmp variable (to store the result)
-                        size_t r = 0;
-                        for(; r < regs.size(); ++r)
-                            if(regs[r] == false)
-                                break;
-                        if(r == regs.size()) // create a new one if none
-                            regs.push_back(false);
-
-                        ins.params.push_back(new Token(std::to_string(r), RESULT)); // add the temp variable as an extra parameter
-                        ins.hasResult = true;
-                        regs[r] = true; // mark the temp variable as non free
-                        code[xi.first].line.push_back(ins); // store the instruction
-                        xj.erase(xj.begin()+j, xj.begin()+i); // remove the used tokens from the RPN lines
-                        xj[j] = new Token(std::to_string(r), RESULT); // place the temp variable where the used tokens were
-                        i = j;
+                        }
+                    // search a free tmp variable (to store the result)
+                    size_t r = 0;
+                    for(; r < regs.size(); ++r)
+                        if(regs[r] == false)
+                            break;
+                    if(r == regs.size()) // create a new one if none
+                        regs.push_back(false);
+
+                    ins.params.push_back(new Token(std::to_string(r), RESULT)); // add the temp variable as an extra parameter
+                    ins.hasResult = true;
+                    regs[r] = true; // mark the temp variable as non free
+                    func.line.push_back(ins); // store the instruction
+                    xj.erase(xj.begin()+j, xj.begin()+i); // remove the used tokens from the RPN lines
+                    xj[j] = new Token(std::to_string(r), RESULT); // place the temp variable where the used tokens were
+                    i = j;
+
+                    // assignment of an array element
+                    const std::string& o = ins.op->s;
+                    size_t k;
+                    if(ins.op->t != OPERATOR || (o != "=" && (o.size() != 2 || o[1] != '=' || o[0] == '!' || o[0] == '=' || o[0] == '<' || o[0] == '>')) ||
+                       (k = findLoad(func.line, first, func.line.size()-1, ins.params[0])) == SIZE_MAX)
                         break;
+                    Instruction& x = func.line.back();
+                    if(o == "=") // a[i] = v: the load becomes the store
+                    {
+                        Instruction ld = func.line[k];
+                        func.line.erase(func.line.begin()+k);
+                        Instruction& st = func.line.back();
+                        regs[ld.params[2]->getInt()] = false;
+                        delete ld.params[2];
+                        delete st.params[0];
+                        delete st.op;
+                        st.op = new Token("[]=", OPERATOR, INFIX);
+                        st.params = {ld.params[0], ld.params[1], st.params[1], st.params[2]};
+                        delete ld.op;
+                        storeContainers(func.line, first, st.params[0], func.line);
+                    }
+                    else // a[i] += v: the register holding the element gets the result, then it's stored back
+                    {
+                        x.op->s.pop_back();
+                        size_t s = reserveRegister(regs);
+                        func.line.push_back(storeInstruction(func.line[k], func.line.back().params.back(), new Token(std::to_string(s), RESULT)));
+                        storeContainers(func.line, first, func.line[k].params[0], func.line);
+                        delete xj[j];
+                        xj[j] = new Token(std::to_string(s), RESULT);
                     }
+                    break;
                 }
             }
-            if(!code[xi.first].line.empty() && code[xi.first].line.back().hasResult)
-            {
-                code[xi.first].line.back().params.pop_back();
-                code[xi.first].line.back().hasResult = false;
-            }
-            if(!postfixes.empty())
+        }
+        if(!func.line.empty() && func.line.back().hasResult)
+        {
+            delete func.line.back().params.back();
+            func.line.back().params.pop_back();
+            func.line.back().hasResult = false;
+        }
+        else if(xj.size() == 1 && xj[0]->t == RESULT) // an element store followed by the stores of its containers
+        {
+            for(size_t k = func.line.size(); k-- > first;)
             {
-                do
+                Instruction& x = func.line[k];
+                if(x.hasResult && *(x.params.back()) == *xj[0])
                 {
-                    code[xi.first].line.push_back(postfixes[0]);
-                    postfixes.erase(postfixes.begin());
-                }while(!postfixes.empty());
+                    if(x.op->t == OPERATOR && x.op->s == "[]=")
+                    {
+                        delete x.params.back();
+                        x.params.pop_back();
+                        x.hasResult = false;
+                    }
+                    break;
+                }
             }
-            else if(xj.size() != 1 || xj[0]->t != RESULT)
-                goto fc_end_error;
         }
+        if(!postfixes.empty())
+        {
+            do
+            {
+                func.line.push_back(postfixes[0]);
+                postfixes.erase(postfixes.begin());
+            }while(!postfixes.empty());
+        }
+        else if(xj.size() != 1 || (xj[0]->t != RESULT && func.line.size() == first)) // ++i alone leaves the variable
+            goto fc_end_error;
+        // a while loop restarts from the first instruction of its condition
+        for(size_t k = first; k < func.line.size(); ++k)
+            if(func.line[k].op->t == FUNC && func.line[k].op->s == "while")
+                func.line[first].loop = true;
     }
     return true;
 
@@ -1610,12 +3119,6 @@ fc_end_error:
     std::cout << "unexpected code end" << std::endl;
     goto fc_error;
 fc_error:
-    for(auto &xi: code)
-    {
-        for(auto &xj: xi.second.line)
-            xj.clear();
-    }
-    code.clear();
     for(auto &xi: postfixes)
     {
         xi.clear();
@@ -1623,330 +3126,2111 @@ fc_error:
     return false;
 }
 
-int Script::errorCheck(Compiled& code)
+int Script::errorCheck(Compiled& code, ThreadPool& pool)
 {
-    for(auto &xi: code)
+    return forEachFunction(code, pool, [&code](const std::string&, Code& func) -> int
     {
-        Code& func = xi.second;
-        for(auto &xj: func.line)
+        return errorCheckFunction(func, code);
+    });
+}
+
+int Script::errorCheckFunction(const Code& func, const Compiled& code)
+{
+    for(auto &xj: func.line)
+    {
+        switch(xj.op->t)
         {
-            switch(xj.op->t)
+            case FUNC:
             {
-                case FUNC:
+                size_t p;
+                auto ast = code.find(xj.op->s);
+                if(ast != code.end())
+                    p = ast->second.argn;
+                else
                 {
-                    size_t p;
-                    auto ast = code.find(xj.op->s);
-                    if(ast != code.end())
-                        p = ast->second.argn;
-                    else
-                    {
-                        auto bst = gl_func.find(xj.op->s);
-                        if(bst != gl_func.end())
-                            p = bst->second;
-                        else return 3;
-                    }
-
-                    if(xj.hasResult)
-                        p++;
-                    if(p != xj.params.size())
-                        return 4;
+                    auto bst = gl_func.find(xj.op->s);
+                    if(bst != gl_func.end())
+                        p = bst->second;
+                    else return 3;
                 }
-                case OPERATOR: case LCUR: case RCUR:
-                    break;
-                default:
-                    return 1;
+
+                if(xj.hasResult)
+                    p++;
+                if(p != xj.params.size())
+                    return 4;
             }
-            for(auto &xk: xj.params)
+            case OPERATOR: case LCUR: case RCUR:
+                break;
+            default:
+                return 1;
+        }
+        for(auto &xk: xj.params)
+        {
+            switch(xk->t)
             {
-                switch(xk->t)
-                {
-                    case FUNC: case OPERATOR: case LCUR: case RCUR:
-                        return 2;
-                    default:
-                        break;
-                }
+                case FUNC: case OPERATOR: case LCUR: case RCUR:
+                    return 2;
+                default:
+                    break;
             }
         }
     }
     return 0;
 }
 
-bool Script::postprocessing(Compiled& code)
+// the functions which can't change a global variable
+// builtins computing a value from their parameters only
+static bool isArrayBuiltin(const std::string& f)
+{
+    return (gl_builtin.count(f) && f != "remove");
+}
+
+static int nativeAttributes(const std::string& f)
+{
+    auto it = gl_attr.find(f);
+    return (it != gl_attr.end() ? it->second : 0);
+}
+
+static bool isPureNative(const std::string& f)
+{
+    return (nativeAttributes(f) & Script::PURE);
+}
+
+static bool isHarmlessBuiltin(const std::string& f)
+{
+    return (isCondition(f) || f == "print" || f == "debug" || f == "return" || gl_builtin.count(f) || (nativeAttributes(f) & (Script::PURE | Script::NO_GLOBAL_WRITES)));
+}
+
+static void noteWrite(Code& func, const Token* t)
+{
+    if(t->t == GVAR) func.globalWrites.insert(t->getInt());
+    else if(t->t == SVAR) func.scriptWrites.insert(t->getInt());
+}
+
+// finds the global variables each function may write, its callees included (before postprocessing)
+static void summarizeGlobalWrites(Compiled& code)
 {
+    static const std::set<std::string> assign = {"=", "+=", "-=", "*=", "/=", "%=", "++", "--", "[]=", "remove"};
+    std::map<std::string, std::set<std::string> > calls;
     for(auto &xi: code)
     {
-        std::vector<Instruction>& ins = xi.second.line;
-        std::vector<std::pair<Token*, Token*> > replace;
-        size_t c;
-        size_t ri;
-        for(int i = 0; i < (int)ins.size(); ++i)
+        Code& func = xi.second;
+        for(auto &xj: func.line)
         {
-            // Instruction()
-            switch(ins[i].op->t)
-            {
-                case FUNC:
-                    if(code.find(ins[i].op->s) != code.end())
-                        c = code[ins[i].op->s].argn;
-                    else if(gl_func.find(ins[i].op->s) != gl_func.end())
-                        c = gl_func[ins[i].op->s];
-                    break;
-                case OPERATOR:
-                    if(isSingleOp(ins[i].op->s) || (ins[i].op->s == "-" && ins[i].op->o == PREFIX))
-                        c = 1;
-                    else c = 2;
-                    break;
-                case LCUR: case RCUR:
-                    continue;
-                default:
-                    return false;
-            }
-            if((ins[i].hasResult && ins[i].params.size() != c + 1) ||
-               (!ins[i].hasResult && ins[i].params.size() != c))
-                return false;
-
-            for(size_t j = 0; j < c; ++j)
+            if(xj.op->t == FUNC)
             {
-                for(ri = 0; ri < replace.size(); ++ri)
-                    if(*(replace[ri].first) == *(ins[i].params[j]))
-                        break;
-                if(ri != replace.size())
-                {
-                    delete ins[i].params[j];
-                    ins[i].params[j] = new Token(*(replace[ri].second));
-                    delete replace[ri].first;
-                    delete replace[ri].second;
-                    replace.erase(replace.begin()+ri);
-                }
+                if(code.find(xj.op->s) != code.end())
+                    calls[xi.first].insert(xj.op->s);
+                else if(!isHarmlessBuiltin(xj.op->s)) // a native can do anything
+                    func.anyGlobalWrite = true;
             }
-            if(ins[i].hasResult)
+            if(xj.hasResult)
+                noteWrite(func, xj.params.back());
+            if((xj.op->t == OPERATOR || xj.op->t == FUNC) && assign.count(xj.op->s) && !xj.params.empty())
+                noteWrite(func, xj.params[0]);
+        }
+    }
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(auto &xi: calls)
+        {
+            Code& func = code[xi.first];
+            for(auto &xj: xi.second)
             {
-                for(ri = 0; ri < replace.size(); ++ri)
-                    if(*(replace[ri].first) == *(ins[i].params[c]))
-                        break;
-                if(ri != replace.size())
+                const Code& callee = code[xj];
+                if(callee.anyGlobalWrite && !func.anyGlobalWrite)
                 {
-                    delete replace[ri].first;
-                    delete replace[ri].second;
-                    replace.erase(replace.begin()+ri);
+                    func.anyGlobalWrite = true;
+                    changed = true;
                 }
-            }
-
-            switch(ins[i].op->t)
-            {
-                case OPERATOR:
-                    if(ins[i].op->s == "=")
-                    {
-                        int pzt = ins[i].params[0]->t;
-                        if(!ins[i].hasResult && (pzt != VAR && pzt != RESULT && pzt != GVAR))
-                        {
-                            ins[i].clear();
-                            ins.erase(ins.begin()+i);
-                            break;
-                        }
-                        else if(ins[i].hasResult && (pzt == VAR || pzt == RESULT || pzt == GVAR))
-                        {
-                            replace.push_back({ins[i].params[2], new Token(*(ins[i].params[0]))});
-                            ins[i].params.pop_back();
-                            ins[i].hasResult = false;
-                        }
-                        if(!ins[i].hasResult && (pzt == VAR || pzt == RESULT || pzt == GVAR) && ins[i].params[1]->t == RESULT)
-                        {
-                            for(int j = i - 1; j >= 0; --j)
-                            {
-                                if(ins[j].hasResult && *(ins[j].params.back()) == *(ins[i].params[1]))
-                                {
-                                    delete ins[j].params[ins[j].params.size()-1];
-                                    ins[j].params[ins[j].params.size()-1] = ins[i].params[0];
-                                    ins[i].params[0] = nullptr;
-                                    ins[i].clear();
-                                    ins.erase(ins.begin()+i);
-                                    i--;
-                                    break;
-                                }
-
-                            }
-                        }
-                    }
-                    else if(ins[i].op->s == "-" && ins[i].op->o == PREFIX)
-                    {
-                        if(ins[i].hasResult)
-                        {
-                            if(ins[i].params[0]->isNumber())
-                            {
-                                ins[i].params[0]->inverseSign();
-                                replace.push_back({ins[i].params[1], ins[i].params[0]});
-                                ins[i].params.clear();
-                                ins[i].clear();
-                                ins.erase(ins.begin()+i);
-                                i--;
-                            }
-                        }
-                        else
-                        {
-                            ins[i].clear();
-                            ins.erase(ins.begin()+i);
-                            i--;
-                        }
-                    }
-                    else // +=, -=, etc... NOT != and ==
-                    {
-                        std::string tmp = ins[i].op->s;
-                        if(tmp.size() == 2 && tmp[1] == '=' && tmp[0] != '!' && tmp[0] != '=' && tmp[0] != '>' && tmp[0] != '<')
-                        {
-                            int pzt = ins[i].params[0]->t;
-                            if(ins[i].hasResult && (pzt == VAR || pzt == RESULT || pzt == GVAR))
-                            {
-                                replace.push_back({ins[i].params[2], new Token(*(ins[i].params[0]))});
-                                ins[i].params.pop_back();
-                                ins[i].hasResult = false;
-                            }
-                        }
-                    }
-                    break;
-                default:
-                    continue;
+                for(auto xk: callee.globalWrites)
+                    if(func.globalWrites.insert(xk).second)
+                        changed = true;
+                for(auto xk: callee.scriptWrites)
+                    if(func.scriptWrites.insert(xk).second)
+                        changed = true;
             }
         }
-        for(auto r: replace)
-            delete r.first;
     }
+}
+
+// finds the pure functions (Code::pure), a memo function must be one (before postprocessing)
+static bool checkMemo(Compiled& code)
+{
+    std::map<std::string, std::set<std::string> > calls;
     for(auto &xi: code)
     {
         Code& func = xi.second;
-        func.creg = 0;
+        if(func.line.empty()) // known function (streaming compile), already checked
+            continue;
+        func.pure = true;
         for(auto &xj: func.line)
         {
-            switch(xj.op->t)
+            if(xj.op->t == FUNC)
             {
-                case OPERATOR:
-                {
-                    Token *tmp = new Token(std::to_string(op_unordered_map.at(xj.op->s)), COP);
-                    delete xj.op;
-                    xj.op = tmp;
-                    break;
-                }
-                default:
-                    break;
+                const std::string& f = xj.op->s;
+                if(code.find(f) != code.end())
+                    calls[xi.first].insert(f);
+                else if(!isCondition(f) && f != "return" && f != "break" && !gl_builtin.count(f) && !isPureNative(f))
+                    func.pure = false;
             }
-            for(auto &xk: xj.params)
+            for(auto xk: xj.params)
+                if(xk->t == GVAR || xk->t == SVAR)
+                    func.pure = false;
+        }
+    }
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(auto &xi: calls)
+        {
+            Code& func = code[xi.first];
+            for(auto &xj: xi.second)
             {
-                switch(xk->t)
+                if(func.pure && !code[xj].pure)
                 {
-                    case VAR:
+                    func.pure = false;
+                    changed = true;
+                }
+            }
+        }
+    }
+    for(auto &xi: code)
+    {
+        if(xi.second.memo && !xi.second.pure)
+        {
+            std::cout << "memo function " << xi.first << " can't use global or script variables, print, debug or natives which aren't PURE" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// the operations changing the variable given as first parameter (=, ++, +=, etc... and the array element store)
+static bool isAssignment(const int& op)
+{
+    return (op == 0 || (op >= 18 && op <= 23) || op == 25 || op == 31 || op == 33);
+}
+
+// marks a cleared instruction as removed, a loop marker moves to the next instruction
+// (the removed instructions are erased all at once by compactInstructions)
+static void removeInstruction(std::vector<Instruction>& ins, const size_t& i)
+{
+    ins[i].op = nullptr;
+    ins[i].params.clear();
+    ins[i].hasResult = false;
+    if(ins[i].loop && i+1 < ins.size())
+        ins[i+1].loop = true;
+    ins[i].loop = false;
+}
+
+static void compactInstructions(std::vector<Instruction>& ins)
+{
+    size_t j = 0;
+    for(size_t i = 0; i < ins.size(); ++i)
+    {
+        if(!ins[i].op) continue;
+        if(i != j) std::swap(ins[j], ins[i]);
+        ++j;
+    }
+    ins.resize(j);
+}
+
+// index of the } closing the block opened at i
+static size_t blockEnd(const std::vector<Instruction>& ins, const size_t& i)
+{
+    int depth = 0;
+    size_t e = i;
+    for(; e < ins.size(); ++e)
+    {
+        if(ins[e].op->t == LCUR) ++depth;
+        else if(ins[e].op->t == RCUR && --depth == 0) break;
+    }
+    return e;
+}
+
+// short-circuit && and || (see lowerShortCircuits()): op 26/27 jumps over the right operand to the final op 28/29
+static bool isShortCircuitJump(const Instruction& x)
+{
+    return x.op && x.op->t == COP && (x.op->getInt() == 26 || x.op->getInt() == 27);
+}
+
+static bool isShortCircuitEnd(const Instruction& x)
+{
+    return x.op && x.op->t == COP && (x.op->getInt() == 28 || x.op->getInt() == 29);
+}
+
+// index of the final && or || of the jump at i
+static size_t shortCircuitEnd(const std::vector<Instruction>& ins, const size_t& i)
+{
+    int depth = 0;
+    size_t e = i;
+    for(; e < ins.size(); ++e)
+    {
+        if(isShortCircuitJump(ins[e])) ++depth;
+        else if(isShortCircuitEnd(ins[e]) && --depth == 0) break;
+    }
+    return e;
+}
+
+// the jump at i is removed (its left operand is known), the final operation becomes a normal && or ||
+static void removeShortCircuit(std::vector<Instruction>& ins, const size_t& i)
+{
+    size_t e = shortCircuitEnd(ins, i);
+    if(e < ins.size())
+    {
+        int op = ins[e].op->getInt();
+        delete ins[e].op;
+        ins[e].op = new Token(op == 28 ? "15" : "17", COP);
+    }
+    ins[i].clear();
+    removeInstruction(ins, i);
+}
+
+// compile time copy of a run time value (used by the constant folding)
+struct Constant
+{
+    int t = INVALID;
+    int i = 0;
+    float f = 0.f;
+    std::string s;
+};
+
+static bool getConstant(const Token* tk, Constant& c)
+{
+    switch(tk->t)
+    {
+        case INT: c.t = INT; c.i = tk->getInt(); return true;
+        case FLOAT: c.t = FLOAT; c.f = tk->getFloat(); return true;
+        case STR: c.t = STR; c.s = tk->getStrippedString(); return true;
+        default: return false;
+    }
+}
+
+static Token* constantToken(const Constant& c)
+{
+    switch(c.t)
+    {
+        case INT: return new Token(std::to_string(c.i), INT);
+        case FLOAT:
+        {
+            std::ostringstream ss;
+            ss << std::setprecision(9) << c.f; // enough digits to read the same float back
+            return new Token(ss.str(), FLOAT);
+        }
+        default: return new Token("\"" + c.s + "\"", STR);
+    }
+}
+
+static float toFloat(const Constant& c) { return (c.t == INT ? (float)c.i : c.f); }
+static bool toBool(const Constant& c) { return (c.t == INT ? c.i != 0 : (c.t == FLOAT ? c.f != 0.f : !c.s.empty())); }
+static std::string toString(const Constant& c) { return (c.t == INT ? std::to_string(c.i) : (c.t == FLOAT ? std::to_string(c.f) : c.s)); }
+
+template<class T> static int compare(const T& a, const T& b, const int& op)
+{
+    switch(op)
+    {
+        case 6: return a != b;
+        case 7: return a > b;
+        case 8: return a < b;
+        case 9: return a >= b;
+        case 10: return a <= b;
+        default: return a == b;
+    }
+}
+
+// same results as Script::operation(), returns false if the operation must be left to the run time (errors included)
+static bool foldOperation(const int& op, const Constant* v, const size_t& n, Constant& r)
+{
+    const Constant& a = v[0];
+    const Constant& b = v[n > 1 ? 1 : 0];
+    bool ints = (a.t == INT && b.t == INT);
+    bool strs = (a.t == STR || b.t == STR);
+    r = Constant();
+    r.t = INT;
+    switch(op)
+    {
+        case 0: r = a; return true;
+        case 1: case 20: // + +=
+            if(strs) { r.t = STR; r.s = toString(a) + toString(b); }
+            else if(ints) r.i = (int)((unsigned)a.i + (unsigned)b.i);
+            else { r.t = FLOAT; r.f = toFloat(a) + toFloat(b); }
+            return true;
+        case 2: case 21: // - -=
+            if(strs) return false;
+            if(op == 2 && n == 1)
+            {
+                if(a.t == INT) r.i = (int)(0u - (unsigned)a.i);
+                else { r.t = FLOAT; r.f = -a.f; }
+            }
+            else if(ints) r.i = (int)((unsigned)a.i - (unsigned)b.i);
+            else { r.t = FLOAT; r.f = toFloat(a) - toFloat(b); }
+            return true;
+        case 3: case 22: // * *=
+            if(strs) return false;
+            if(ints) r.i = (int)((unsigned)a.i * (unsigned)b.i);
+            else { r.t = FLOAT; r.f = toFloat(a) * toFloat(b); }
+            return true;
+        case 4: case 23: // / /=
+            if(strs || (b.t == INT && b.i == 0) || (b.t == FLOAT && b.f == 0.f)) return false;
+            if(ints)
+            {
+                if(a.i == INT_MIN && b.i == -1) return false;
+                r.i = a.i / b.i;
+            }
+            else { r.t = FLOAT; r.f = toFloat(a) / toFloat(b); }
+            return true;
+        case 24: case 25: // % %=
+            if(!ints || b.i == 0 || (a.i == INT_MIN && b.i == -1)) return false;
+            r.i = a.i % b.i;
+            return true;
+        case 5: // !
+            r.i = !toBool(a);
+            return true;
+        case 6: case 7: case 8: case 9: case 10: case 11: // comparisons (always false between a string and a number)
+            if(a.t == STR && b.t == STR) r.i = compare(a.s, b.s, op);
+            else if(strs) r.i = 0;
+            else if(ints) r.i = compare(a.i, b.i, op);
+            else r.i = compare(toFloat(a), toFloat(b), op);
+            return true;
+        case 12: case 13: case 14: // & ^ |
+            if(!ints) return false;
+            r.i = (op == 12 ? a.i & b.i : (op == 13 ? a.i ^ b.i : a.i | b.i));
+            return true;
+        case 15: r.i = toBool(a) && toBool(b); return true;
+        case 16: r.i = toBool(a) != toBool(b); return true;
+        case 17: r.i = toBool(a) || toBool(b); return true;
+        case 18: case 19: // ++ --
+            if(a.t == STR) return false;
+            if(a.t == INT) r.i = (int)((unsigned)a.i + (op == 18 ? 1u : -1u));
+            else { r.t = FLOAT; r.f = a.f + (op == 18 ? 1 : -1); }
+            return true;
+        default: return false;
+    }
+}
+
+// runs a hard-coded function at compile time (the Script part only holds the result register)
+class NativeCall: public Script
+{
+    public:
+        bool call(const Callback& f, const std::vector<Constant>& v, Constant& r)
+        {
+            silent = true;
+            state = PLAY;
+            currentRegs.resize(1);
+            Line l;
+            l.hasResult = true;
+            l.params.resize(v.size()+1);
+            for(size_t i = 0; i < v.size(); ++i)
+            {
+                switch(v[i].t)
+                {
+                    case INT: l.params[i].set(v[i].i); break;
+                    case FLOAT: l.params[i].set(v[i].f); break;
+                    default: l.params[i].set(v[i].s); break;
+                }
+            }
+            int reg = 0;
+            l.params.back().set(&reg, RESULT);
+            f(this, l);
+            for(auto &xi: l.params)
+                xi.clear();
+            const Value& x = currentRegs[0];
+            r = Constant();
+            r.t = x.getType();
+            switch(r.t)
+            {
+                case INT: r.i = *x.get<int>(); break;
+                case FLOAT: r.f = *x.get<float>(); break;
+                case STR: r.s = *x.get<std::string>(); break;
+                default: return false;
+            }
+            return (state != ERROR);
+        }
+};
+
+// a PURE hard-coded function whose parameters are all known is replaced by its result
+static bool foldNative(const Instruction& x, Constant& r)
+{
+    if(x.op->t != FUNC || !x.hasResult || !isPureNative(x.op->s))
+        return false;
+    auto f = gl_callback.find(x.op->s);
+    if(f == gl_callback.end())
+        return false;
+    std::vector<Constant> v(x.params.size()-1);
+    for(size_t j = 0; j < v.size(); ++j)
+        if(!getConstant(x.params[j], v[j]))
+            return false;
+    NativeCall s;
+    return s.call(f->second, v, r);
+}
+
+// the local variables written by the instructions [a, b] become unknown
+static void forgetWritten(const std::vector<Instruction>& ins, const size_t& a, const size_t& b, std::map<int, Constant>& vars)
+{
+    for(size_t i = a; i <= b && i < ins.size(); ++i)
+    {
+        const Instruction& x = ins[i];
+        if(!x.op || (x.op->t != COP && x.op->t != FUNC)) continue; // removed or block limit
+        int op = (x.op->t == COP ? x.op->getInt() : -1);
+        if(x.hasResult && x.params.back()->t == CVAR)
+            vars.erase(x.params.back()->getInt());
+        if(isAssignment(op) && x.params[0]->t == CVAR)
+            vars.erase(x.params[0]->getInt());
+    }
+}
+
+// constant folding and propagation over the compiled instructions (COP, CVAR)
+// after a block (and when entering a loop), the variables it writes are unknown
+static size_t foldConstants(Code& func, const Compiled& code)
+{
+    std::vector<Instruction>& ins = func.line;
+    std::map<int, Constant> vars, regs; // known contents of the local variables and registers
+    std::set<int> written; // registers used as an assignment target, never removed
+    std::vector<std::pair<size_t, std::map<int, Constant> > > blocks; // block start and known variables when entering it
+    size_t removed = 0;
+    Constant v[2], r;
+
+    for(auto &xi: ins)
+    {
+        if(xi.op->t == COP && !xi.params.empty() && xi.params[0]->t == RESULT)
+        {
+            int op = xi.op->getInt();
+            if(isAssignment(op))
+                written.insert(xi.params[0]->getInt());
+        }
+    }
+
+    for(size_t i = 0; i < ins.size(); ++i)
+    {
+        if(!ins[i].op) // right operand of a removed short-circuit
+            continue;
+        if(ins[i].loop) // forget what the loop changes
+        {
+            size_t w = i;
+            while(w < ins.size() && !(ins[w].op->t == FUNC && ins[w].op->s == "while")) ++w;
+            forgetWritten(ins, i, (w+1 < ins.size() && ins[w+1].op->t == LCUR) ? blockEnd(ins, w+1) : ins.size(), vars);
+        }
+        if(ins[i].op->t == LCUR)
+            blocks.push_back({i, vars});
+        else if(ins[i].op->t == RCUR) // the block may have been skipped
+        {
+            if(blocks.empty())
+                vars.clear();
+            else
+            {
+                vars.swap(blocks.back().second);
+                forgetWritten(ins, blocks.back().first, i, vars);
+                blocks.pop_back();
+            }
+        }
+        if(ins[i].op->t != COP && ins[i].op->t != FUNC)
+            continue;
+
+        Instruction& x = ins[i];
+        int op = (x.op->t == COP ? x.op->getInt() : -1);
+        bool assign = isAssignment(op); // the first parameter is the target
+        size_t n = x.params.size() - (x.hasResult ? 1 : 0);
+        // natives may use their parameters as variables, only our own functions get the values
+        bool local = (x.op->t == COP || code.find(x.op->s) != code.end() || isCondition(x.op->s) ||
+                      x.op->s == "return" || x.op->s == "print" || x.op->s == "debug" || isArrayBuiltin(x.op->s) || isPureNative(x.op->s));
+
+        // replace the known values in the parameters read
+        for(size_t j = (assign ? 1 : 0); j < n; ++j)
+        {
+            Token*& p = x.params[j];
+            std::map<int, Constant>::iterator it;
+            if(p->t == RESULT && (it = regs.find(p->getInt())) != regs.end())
+            {
+                delete p;
+                p = constantToken(it->second);
+            }
+            else if(p->t == CVAR && local && (it = vars.find(p->getInt())) != vars.end())
+            {
+                delete p;
+                p = constantToken(it->second);
+            }
+        }
+
+        if(op == 26 || op == 27) // short-circuit jump
+        {
+            Constant c;
+            if(getConstant(x.params[0], c))
+            {
+                size_t e = shortCircuitEnd(ins, i);
+                bool skip = (toBool(c) == (op == 27)); // the right operand is never computed
+                Token* p = (x.hasResult ? new Token(*x.params.back()) : nullptr);
+                removeShortCircuit(ins, i);
+                ++removed;
+                if(skip)
+                {
+                    for(size_t j = i+1; j < e && j < ins.size(); ++j)
+                    {
+                        if(!ins[j].op) continue;
+                        ins[j].clear();
+                        removeInstruction(ins, j);
+                        ++removed;
+                    }
+                    if(p && p->t == RESULT)
+                    {
+                        c.t = INT;
+                        c.i = 0;
+                        regs[p->getInt()] = c;
+                    }
+                }
+                delete p;
+                continue;
+            }
+            blocks.push_back({i, vars}); // like a block, the right operand may not run
+            if(x.hasResult && x.params.back()->t == RESULT)
+                regs.erase(x.params.back()->getInt());
+            continue;
+        }
+        if((op == 28 || op == 29) && !blocks.empty()) // end of the right operand
+        {
+            vars.swap(blocks.back().second);
+            forgetWritten(ins, blocks.back().first, i, vars);
+            blocks.pop_back();
+        }
+
+        Token* target = (x.hasResult ? x.params.back() : (assign ? x.params[0] : nullptr));
+        bool known = (op >= 0 && n <= 2 && (!assign || !x.hasResult));
+        size_t m = 0; // operands
+        for(size_t j = (op == 0 ? 1 : 0); known && j < n; ++j, ++m)
+        {
+            auto it = vars.end();
+            if(!getConstant(x.params[j], v[m]) &&
+               (x.params[j]->t != CVAR || (it = vars.find(x.params[j]->getInt())) == vars.end()))
+                known = false;
+            else if(it != vars.end())
+                v[m] = it->second;
+        }
+        if((known && m > 0 && foldOperation(op, v, m, r)) || foldNative(x, r))
+        {
+            if(target && target->t == RESULT && !written.count(target->getInt()))
+            {
+                regs[target->getInt()] = r;
+                x.clear();
+                removeInstruction(ins, i);
+                ++removed;
+                continue;
+            }
+            if(!target) // no effect
+            {
+                x.clear();
+                removeInstruction(ins, i);
+                ++removed;
+                continue;
+            }
+            if(op != 0) // becomes an assignment
+            {
+                for(auto &xj: x.params)
+                    if(xj != target)
+                        delete xj;
+                x.params = {target, constantToken(r)};
+                x.hasResult = false;
+                delete x.op;
+                x.op = new Token("0", COP);
+            }
+            if(target->t == CVAR)
+                vars[target->getInt()] = r;
+            else if(target->t == RESULT) // kept, but its reads until the next assignment are replaced
+                regs[target->getInt()] = r;
+            continue;
+        }
+        if(target && target->t == CVAR)
+            vars.erase(target->getInt());
+        else if(target && target->t == RESULT)
+            regs.erase(target->getInt());
+        if((op == 31 || op == 33) && x.hasResult && x.params[0]->t == CVAR) // element store or key removal, with a result
+            vars.erase(x.params[0]->getInt());
+    }
+    compactInstructions(ins);
+    return removed;
+}
+
+// erases the instructions [a, b]
+static void eraseInstructions(std::vector<Instruction>& ins, const size_t& a, const size_t& b)
+{
+    for(size_t i = a; i <= b && i < ins.size(); ++i)
+        ins[i].clear();
+    ins.erase(ins.begin()+a, ins.begin()+std::min(b+1, ins.size()));
+}
+
+// the parameter is a literal, or a value marked by scalarValues()
+static bool isScalar(const Token* p, const std::vector<bool>& scalar, const size_t& nvar)
+{
+    size_t id;
+    switch(p->t)
+    {
+        case INT: case FLOAT: case STR: return true;
+        case CVAR: id = p->getInt(); break;
+        case RESULT: id = nvar + p->getInt(); break;
+        default: return false;
+    }
+    return (id < scalar.size() && scalar[id]);
+}
+
+// an operation without side effect and which can't raise an error (if its operands are set)
+// +, !, the comparisons and the logical operators only when their operands are INT, FLOAT or STR (see scalarValues()): arrays and dictionaries can fail
+static bool isPureOperation(const Instruction& x, const std::vector<bool>& scalar, const size_t& nvar)
+{
+    if(x.op->t == FUNC) return isPureNative(x.op->s);
+    if(x.op->t != COP) return false;
+    switch(x.op->getInt())
+    {
+        case 0:
+            return true;
+        case 1: case 5: case 6: case 7: case 8: case 9: case 10: case 11: case 15: case 16: case 17:
+        {
+            size_t n = x.params.size() - (x.hasResult ? 1 : 0);
+            for(size_t j = 0; j < n; ++j)
+                if(!isScalar(x.params[j], scalar, nvar))
+                    return false;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// variables (CVAR, then RESULT after the CVAR) read and written by an instruction
+static void instructionAccess(const Instruction& x, const size_t& nvar, std::vector<size_t>& r, std::vector<size_t>& w, bool& global)
+{
+    r.clear();
+    w.clear();
+    global = false;
+    if(x.op->t != COP && x.op->t != FUNC) return;
+    int op = (x.op->t == COP ? x.op->getInt() : -1);
+    bool assign = isAssignment(op);
+    size_t n = x.params.size() - (x.hasResult ? 1 : 0);
+    for(size_t j = 0; j < x.params.size(); ++j)
+    {
+        const Token* p = x.params[j];
+        bool read = (j < n && !(op == 0 && j == 0));
+        bool write = ((x.hasResult && j == x.params.size()-1) || (assign && j == 0));
+        size_t id;
+        if(p->t == CVAR) id = p->getInt();
+        else if(p->t == RESULT) id = nvar + p->getInt();
+        else
+        {
+            if((p->t == GVAR || p->t == SVAR) && write) global = true;
+            continue;
+        }
+        if(read) r.push_back(id);
+        if(write) w.push_back(id);
+    }
+}
+
+// values (instructionAccess() ids) which always hold an INT, FLOAT or STR when they are set: every write gives one
+// the calls, the element loads and the global and script variables can give an array or a dictionary, the parameters too (unless Code::scalarParams says otherwise)
+// partial: the local variables may come from a previous chunk (streaming compile), none is known
+static std::vector<bool> scalarValues(const Code& func, const bool& partial)
+{
+    const std::vector<Instruction>& ins = func.line;
+    size_t nvar = func.var.size();
+    size_t n = nvar;
+    for(auto &xi: ins)
+        for(auto &xj: xi.params)
+            if(xj->t == RESULT && nvar + xj->getInt() + 1 > n)
+                n = nvar + xj->getInt() + 1;
+    std::vector<bool> scalar(n, true);
+    for(size_t i = 0; i < nvar; ++i)
+        if(partial || (i < func.argn && !(i < func.scalarParams.size() && func.scalarParams[i])))
+            scalar[i] = false;
+
+    auto known = [&](const Token* p) -> bool { return isScalar(p, scalar, nvar); };
+    std::vector<size_t> r, w;
+    bool global;
+    bool stable = false;
+    while(!stable)
+    {
+        stable = true;
+        for(auto &x: ins)
+        {
+            instructionAccess(x, nvar, r, w, global);
+            if(w.empty())
+                continue;
+            bool result = false;
+            if(x.op->t == COP)
+            {
+                switch(x.op->getInt())
+                {
+                    case 0: result = known(x.params[1]); break;
+                    case 26: case 27: case 32: result = true; break; // 0 or 1
+                    case 30: case 31: case 33: result = false; break;
+                    default:
+                    {
+                        result = true;
+                        size_t m = x.params.size() - (x.hasResult ? 1 : 0);
+                        for(size_t j = 0; j < m; ++j)
+                            result = result && known(x.params[j]);
+                        break;
+                    }
+                }
+            }
+            else if(x.op->t == FUNC)
+                result = ((x.op->s == "size" || x.op->s == "sum" || x.op->s == "min" || x.op->s == "max" || x.op->s == "dot") && gl_builtin.count(x.op->s)); // a host function of the same name may return anything
+            if(result)
+                continue;
+            for(auto xj: w)
+            {
+                if(scalar[xj])
+                {
+                    scalar[xj] = false;
+                    stable = false;
+                }
+            }
+        }
+    }
+    return scalar;
+}
+
+// marks the parameters every call site gives an INT, FLOAT or STR (Code::scalarParams), the host can't call a script function
+// not done for a streaming compile: the calls of the next chunks aren't known yet
+static void inferScalarParams(Compiled& code)
+{
+    auto main = code.find("");
+    if(main == code.end() || main->second.partial)
+        return;
+    for(auto &xi: code)
+        xi.second.scalarParams.assign(xi.second.argn, true);
+    bool stable = false;
+    while(!stable)
+    {
+        stable = true;
+        for(auto &xi: code)
+        {
+            const Code& func = xi.second;
+            std::vector<bool> scalar = scalarValues(func, false);
+            for(auto &x: func.line)
+            {
+                if(x.op->t != FUNC)
+                    continue;
+                auto f = code.find(x.op->s);
+                if(f == code.end())
+                    continue;
+                std::vector<bool>& params = f->second.scalarParams;
+                for(size_t j = 0; j < params.size() && j < x.params.size(); ++j)
+                {
+                    if(params[j] && !isScalar(x.params[j], scalar, func.var.size()))
+                    {
+                        params[j] = false;
+                        stable = false;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// short-circuit evaluation of && and ||: "a && b" becomes
+//   (a) -> rA, && jump (op 26) rA -> rB, (b) -> rB, && final (op 28) rA rB
+// the jump goes to the final operation when rA decides the result, writing 0 in rB so it still reads a value (op 27 and 29 for ||)
+// it's only done when b needs some instructions, the optimizations see the jump and keep the pair together
+static size_t lowerShortCircuits(Code& func)
+{
+    std::vector<Instruction>& ins = func.line;
+    size_t nvar = func.var.size();
+    std::vector<size_t> r, w;
+    bool global;
+    // instruction writing the register "reg" last before "before" (SIZE_MAX if none in the same line)
+    auto findDef = [&](const size_t& reg, size_t before) -> size_t
+    {
+        while(before-- > 0)
+        {
+            if(ins[before].op->t != COP && ins[before].op->t != FUNC)
+                break;
+            instructionAccess(ins[before], nvar, r, w, global);
+            if(std::find(w.begin(), w.end(), reg) != w.end())
+                return before;
+        }
+        return SIZE_MAX;
+    };
+
+    size_t count = 0;
+    for(size_t f = 0; f < ins.size(); ++f)
+    {
+        const Instruction& x = ins[f];
+        if(x.op->t != COP || (x.op->getInt() != 15 && x.op->getInt() != 17) || !x.hasResult || x.params.size() != 3 || x.params[1]->t != RESULT)
+            continue;
+
+        // the right operand: its definition and the ones of the registers it reads, recursively (contiguous, ending just before f)
+        std::set<size_t> nodes;
+        std::vector<std::pair<size_t, size_t> > todo = {{nvar + x.params[1]->getInt(), f}};
+        bool ok = true;
+        while(ok && !todo.empty())
+        {
+            auto p = todo.back();
+            todo.pop_back();
+            size_t d = findDef(p.first, p.second);
+            if(d == SIZE_MAX)
+                ok = false;
+            else if(nodes.insert(d).second)
+            {
+                instructionAccess(ins[d], nvar, r, w, global);
+                for(auto xi: r)
+                    if(xi >= nvar)
+                        todo.push_back({xi, d});
+            }
+        }
+        if(!ok || nodes.empty())
+            continue;
+        size_t start = *nodes.begin();
+        while(start > 0 && isShortCircuitJump(ins[start-1]) && nodes.count(shortCircuitEnd(ins, start-1))) // the jump of a nested && or || starting the operand
+            --start;
+        for(size_t i = start; ok && i < f; ++i)
+            if(!nodes.count(i) && !isShortCircuitJump(ins[i])) // a jump of a nested && or ||
+                ok = false;
+        if(x.params[0]->t == RESULT)
+        {
+            size_t d = findDef(nvar + x.params[0]->getInt(), f);
+            if(d == SIZE_MAX || d >= start)
+                ok = false;
+        }
+        if(!ok)
+            continue;
+
+        Instruction j;
+        j.op = new Token(x.op->getInt() == 15 ? "26" : "27", COP);
+        j.params.push_back(new Token(*x.params[0]));
+        j.params.push_back(new Token("0", INT)); // length, set by finishShortCircuits()
+        j.params.push_back(new Token(*x.params[1]));
+        j.hasResult = true;
+        j.loop = ins[start].loop;
+        ins[start].loop = false;
+        int op = ins[f].op->getInt();
+        delete ins[f].op;
+        ins[f].op = new Token(op == 15 ? "28" : "29", COP);
+        ins.insert(ins.begin()+start, j);
+        ++f;
+        ++count;
+    }
+    return count;
+}
+
+// dead code elimination on the block structure:
+// - blocks behind a constant condition and the code following a return are removed
+// - stores to local variables and registers which are never read are removed (natives and function calls are always kept)
+// partial: the function continues in another chunk (streaming compile), every local variable is alive at its end
+static size_t eliminateDeadCode(Code& func, const bool& partial)
+{
+    std::vector<Instruction>& ins = func.line;
+    size_t removed = 0;
+    Constant c;
+
+    // unreachable blocks
+    std::vector<int> chain(1, 0); // state of the if/elif/else chain for each depth (0: unknown, 1: no other block will run, 2: the if was removed)
+    for(size_t i = 0; i < ins.size(); ++i)
+    {
+        Instruction& x = ins[i];
+        if(x.op->t == LCUR) { chain.push_back(0); continue; }
+        if(x.op->t == RCUR) { if(chain.size() > 1) chain.pop_back(); continue; }
+        if(x.op->t != FUNC) continue;
+        if(x.op->s == "return") // nothing runs after it in the same block
+        {
+            size_t e = i+1;
+            for(int depth = 0; e < ins.size(); ++e)
+            {
+                if(ins[e].op->t == LCUR) ++depth;
+                else if(ins[e].op->t == RCUR && --depth < 0) break;
+            }
+            if(e > i+1)
+            {
+                removed += e - i - 1;
+                eraseInstructions(ins, i+1, e-1);
+            }
+            continue;
+        }
+        if(!isCondition(x.op->s) || i+1 >= ins.size() || ins[i+1].op->t != LCUR)
+            continue;
+
+        int& state = chain.back();
+        if(x.op->s == "elif" || x.op->s == "else")
+        {
+            if(state == 1) // an earlier block of the chain always runs
+            {
+                size_t e = blockEnd(ins, i+1);
+                removed += e - i + 1;
+                eraseInstructions(ins, i, e);
+                --i;
+                continue;
+            }
+            if(state == 2) // the if was removed, this block starts the chain now
+            {
+                if(x.op->s == "else")
+                    x.params.push_back(new Token("1", INT));
+                x.op->s = "if";
+            }
+        }
+        if(x.op->s == "else")
+        {
+            state = 1;
+            continue;
+        }
+        if(x.op->s == "if" || x.op->s == "while")
+            state = 0;
+        if(x.params.empty() || !getConstant(x.params[0], c))
+            continue;
+        if(toBool(c))
+        {
+            if(x.op->s != "while")
+                state = 1;
+            continue;
+        }
+        if(x.op->s == "if")
+            state = 2;
+        else if(x.op->s == "while" && !x.loop) // the loop head isn't needed anymore
+        {
+            size_t h = i;
+            while(h > 0 && !ins[h].loop) --h;
+            ins[h].loop = false;
+        }
+        size_t e = blockEnd(ins, i+1);
+        removed += e - i + 1;
+        eraseInstructions(ins, i, e);
+        --i;
+    }
+
+    // dead stores, found with a liveness analysis on the control flow graph
+    size_t nvar = func.var.size();
+    size_t nreg = 0;
+    for(auto &xi: ins)
+        for(auto &xj: xi.params)
+            if(xj->t == RESULT && (size_t)xj->getInt() + 1 > nreg)
+                nreg = xj->getInt() + 1;
+    std::vector<size_t> rd, wr;
+    bool global;
+    bool changed = true;
+    while(changed && !ins.empty())
+    {
+        changed = false;
+        // matching { and }
+        std::vector<size_t> match(ins.size(), ins.size());
+        std::vector<size_t> open;
+        for(size_t i = 0; i < ins.size(); ++i)
+        {
+            if(ins[i].op->t == LCUR) open.push_back(i);
+            else if(ins[i].op->t == RCUR && !open.empty())
+            {
+                match[i] = open.back();
+                match[open.back()] = i;
+                open.pop_back();
+            }
+        }
+        // successors of each instruction (ins.size() is the function end)
+        std::vector<std::vector<size_t> > next(ins.size());
+        std::vector<bool> leader(ins.size()+1, false);
+        leader[0] = true;
+        leader[ins.size()] = true;
+        for(size_t i = 0; i < ins.size(); ++i)
+        {
+            const Instruction& x = ins[i];
+            if(x.op->t == FUNC && x.op->s == "return")
+                ;
+            else if(x.op->t == FUNC && isCondition(x.op->s) && i+1 < ins.size() && ins[i+1].op->t == LCUR)
+                next[i] = {i+1, std::min(match[i+1]+1, ins.size())};
+            else if(isShortCircuitJump(x))
+                next[i] = {i+1, shortCircuitEnd(ins, i)};
+            else if(x.op->t == RCUR && match[i] > 0 && match[i] < ins.size() &&
+                    ins[match[i]-1].op->t == FUNC && ins[match[i]-1].op->s == "while") // loop: back to the condition
+            {
+                size_t h = match[i]-1;
+                while(h > 0 && !ins[h].loop) --h;
+                next[i] = {h};
+            }
+            else
+                next[i] = {i+1};
+            if(next[i].size() != 1 || next[i][0] != i+1)
+            {
+                leader[i+1] = true;
+                for(auto xj: next[i])
+                    leader[xj] = true;
+            }
+        }
+
+        // basic blocks
+        std::vector<size_t> start;
+        std::vector<size_t> block(ins.size()+1);
+        for(size_t i = 0; i <= ins.size(); ++i)
+        {
+            if(leader[i]) start.push_back(i);
+            block[i] = start.size()-1;
+        }
+        size_t nb = start.size(); // the last block is the function end (empty)
+        std::vector<std::vector<bool> > gen(nb, std::vector<bool>(nvar+nreg, false)), kill(gen), in(gen), out(gen);
+        for(size_t b = 0; b+1 < nb; ++b)
+        {
+            for(size_t i = start[b]; i < start[b+1]; ++i)
+            {
+                instructionAccess(ins[i], nvar, rd, wr, global);
+                for(auto xj: rd)
+                    if(!kill[b][xj])
+                        gen[b][xj] = true;
+                for(auto xj: wr)
+                    kill[b][xj] = true;
+            }
+        }
+        if(partial)
+            for(size_t v = 0; v < nvar; ++v)
+                in[nb-1][v] = true;
+        bool stable = false;
+        while(!stable)
+        {
+            stable = true;
+            for(size_t b = nb-1; b-- > 0;)
+            {
+                std::vector<bool> o(nvar+nreg, false);
+                for(auto xj: next[start[b+1]-1])
+                    for(size_t v = 0; v < o.size(); ++v)
+                        if(in[block[xj]][v])
+                            o[v] = true;
+                std::vector<bool> n(o.size());
+                for(size_t v = 0; v < o.size(); ++v)
+                    n[v] = gen[b][v] || (o[v] && !kill[b][v]);
+                if(n != in[b] || o != out[b])
+                {
+                    in[b].swap(n);
+                    out[b].swap(o);
+                    stable = false;
+                }
+            }
+        }
+
+        // backward walk in each block
+        std::vector<bool> scalar = scalarValues(func, partial);
+        std::vector<bool> dead(ins.size(), false);
+        for(size_t b = 0; b+1 < nb; ++b)
+        {
+            std::vector<bool> live = out[b];
+            for(size_t i = start[b+1]; i-- > start[b];)
+            {
+                instructionAccess(ins[i], nvar, rd, wr, global);
+                bool used = global;
+                for(auto xj: wr)
+                    if(live[xj])
+                        used = true;
+                if(!used && isPureOperation(ins[i], scalar, nvar))
+                {
+                    dead[i] = true;
+                    changed = true;
+                    continue;
+                }
+                for(auto xj: wr)
+                    live[xj] = false;
+                for(auto xj: rd)
+                    live[xj] = true;
+            }
+        }
+        for(size_t i = 0; i < ins.size(); ++i)
+        {
+            if(dead[i])
+            {
+                ins[i].clear();
+                removeInstruction(ins, i);
+                ++removed;
+            }
+        }
+        compactInstructions(ins);
+    }
+    return removed;
+}
+
+// a PURE hard-coded function called again with the same parameters, in the same block, reuses the first result
+// the first call writes it to a new register, copied to its target, the next ones become copies of this register
+static size_t mergePureCalls(Code& func)
+{
+    std::vector<Instruction>& ins = func.line;
+    size_t nreg = 0;
+    for(auto &xi: ins)
+        for(auto &xj: xi.params)
+            if(xj->t == RESULT && (size_t)xj->getInt() + 1 > nreg)
+                nreg = xj->getInt() + 1;
+    struct Call
+    {
+        size_t line;
+        int reg; // register holding the result (-1 until a second call is found)
+    };
+    std::vector<Call> calls; // the calls whose result is still valid
+    std::map<size_t, Token*> copies; // first call -> target of its result, copied after it
+    size_t merged = 0;
+    auto same = [&ins](const size_t& a, const size_t& b)
+    {
+        const Instruction& x = ins[a];
+        const Instruction& y = ins[b];
+        if(x.op->s != y.op->s || x.params.size() != y.params.size()) return false;
+        for(size_t j = 0; j+1 < x.params.size(); ++j)
+            if(!(*x.params[j] == *y.params[j])) return false;
+        return true;
+    };
+    auto reads = [&ins](const size_t& a, const Token* t)
+    {
+        const Instruction& x = ins[a];
+        for(size_t j = 0; j+1 < x.params.size(); ++j)
+            if(x.params[j]->t == t->t && x.params[j]->s == t->s) return true;
+        return false;
+    };
+    auto readsGlobal = [&ins](const size_t& a)
+    {
+        const Instruction& x = ins[a];
+        for(size_t j = 0; j+1 < x.params.size(); ++j)
+            if(x.params[j]->t == GVAR || x.params[j]->t == SVAR) return true;
+        return false;
+    };
+
+    for(size_t i = 0; i < ins.size(); ++i)
+    {
+        Instruction& x = ins[i];
+        if(x.loop || x.op->t == LCUR || x.op->t == RCUR || isShortCircuitJump(x) || isShortCircuitEnd(x)) // may run more than once, or not at all
+            calls.clear();
+        if(x.op->t != COP && x.op->t != FUNC) continue;
+
+        if(x.op->t == FUNC && x.hasResult && isPureNative(x.op->s) && !(nativeAttributes(x.op->s) & Script::CHEAP))
+        {
+            auto c = calls.begin();
+            while(c != calls.end() && !same(c->line, i)) ++c;
+            if(c != calls.end())
+            {
+                if(c->reg < 0)
+                {
+                    c->reg = nreg++;
+                    Token*& first = ins[c->line].params.back();
+                    copies[c->line] = first;
+                    first = new Token(std::to_string(c->reg), RESULT);
+                }
+                Token* target = x.params.back();
+                x.params.pop_back();
+                x.clear();
+                x.op = new Token("0", COP);
+                x.params = {target, new Token(std::to_string(c->reg), RESULT)};
+                x.hasResult = false;
+                ++merged;
+            }
+            else calls.push_back({i, -1});
+        }
+
+        // the calls reading a variable written here aren't valid anymore
+        int op = (x.op->t == COP ? x.op->getInt() : -1);
+        std::vector<const Token*> w;
+        if(x.hasResult) w.push_back(x.params.back());
+        if(isAssignment(op)) w.push_back(x.params[0]);
+        for(auto xj: w)
+            for(size_t k = calls.size(); k-- > 0;)
+                if(reads(calls[k].line, xj))
+                    calls.erase(calls.begin()+k);
+        if(x.op->t == FUNC && !isHarmlessBuiltin(x.op->s)) // may change any global variable
+            for(size_t k = calls.size(); k-- > 0;)
+                if(readsGlobal(calls[k].line))
+                    calls.erase(calls.begin()+k);
+    }
+
+    if(copies.empty())
+        return 0;
+    std::vector<Instruction> out;
+    out.reserve(ins.size() + copies.size());
+    for(size_t i = 0; i < ins.size(); ++i)
+    {
+        out.push_back(ins[i]);
+        auto it = copies.find(i);
+        if(it != copies.end())
+        {
+            out.push_back(Instruction());
+            out.back().op = new Token("0", COP);
+            out.back().params = {it->second, new Token(*ins[i].params.back())};
+        }
+    }
+    ins.swap(out);
+    return merged;
+}
+
+// local variables set on every path reaching ins[head]: the parameters and the variables written before it, except in the blocks closed before it
+static std::vector<bool> assignedBefore(const std::vector<Instruction>& ins, const size_t& head, const size_t& nvar, const size_t& argn)
+{
+    std::vector<std::vector<size_t> > blocks(1); // written variables, by open block
+    std::vector<size_t> r, w;
+    bool global;
+    for(size_t i = 0; i < head; ++i)
+    {
+        switch(ins[i].op->t)
+        {
+            case LCUR: blocks.push_back(std::vector<size_t>()); break;
+            case RCUR: if(blocks.size() > 1) blocks.pop_back(); break;
+            default:
+                instructionAccess(ins[i], nvar, r, w, global);
+                for(auto xj: w)
+                    if(xj < nvar)
+                        blocks.back().push_back(xj);
+                break;
+        }
+    }
+    std::vector<bool> set(nvar, false);
+    for(size_t i = 0; i < argn && i < nvar; ++i)
+        set[i] = true;
+    for(auto &xi: blocks)
+        for(auto xj: xi)
+            set[xj] = true;
+    return set;
+}
+
+// moves the invariant computations of a while loop body before the loop (head: loop start, [lcur, rcur]: loop body)
+// only the operations which can't fail are moved, they get a new register (nreg is the next free one)
+// their local variables must be set before the loop: the moved code runs even if the loop doesn't
+static size_t hoistLoop(std::vector<Instruction>& ins, const size_t& head, const size_t& lcur, const size_t& rcur, size_t& nreg, const std::vector<bool>& scalar, const size_t& nvar, const size_t& argn, const Compiled& code)
+{
+    std::vector<bool> set = assignedBefore(ins, head, nvar, argn);
+    std::set<int> vars, globals, svars; // variables changed by the loop
+    bool anyGlobal = false;
+    for(size_t i = head; i <= rcur; ++i)
+    {
+        const Instruction& x = ins[i];
+        if(x.op->t == FUNC)
+        {
+            auto f = code.find(x.op->s);
+            if(f != code.end())
+            {
+                anyGlobal = anyGlobal || f->second.anyGlobalWrite;
+                globals.insert(f->second.globalWrites.begin(), f->second.globalWrites.end());
+                svars.insert(f->second.scriptWrites.begin(), f->second.scriptWrites.end());
+            }
+            else if(!isHarmlessBuiltin(x.op->s))
+                anyGlobal = true;
+        }
+        if(x.op->t != COP && x.op->t != FUNC) continue;
+        int op = (x.op->t == COP ? x.op->getInt() : -1);
+        std::vector<Token*> w;
+        if(x.hasResult) w.push_back(x.params.back());
+        if(isAssignment(op)) w.push_back(x.params[0]);
+        for(auto xj: w)
+        {
+            if(xj->t == CVAR) vars.insert(xj->getInt());
+            else if(xj->t == GVAR) globals.insert(xj->getInt());
+            else if(xj->t == SVAR) svars.insert(xj->getInt());
+        }
+    }
+
+    std::vector<Instruction> out;
+    std::map<int, int> moved; // register -> new register of its hoisted computation
+    std::set<int> hoisted; // the new registers
+    for(size_t i = lcur+1; i < rcur; ++i)
+    {
+        Instruction& x = ins[i];
+        if(x.op->t != COP && x.op->t != FUNC) continue;
+        size_t n = x.params.size() - (x.hasResult ? 1 : 0);
+        bool invariant = (isPureOperation(x, scalar, nvar) && (x.op->t == FUNC || x.op->getInt() != 0) && x.hasResult && x.params.back()->t == RESULT);
+        for(size_t j = 0; j < n; ++j)
+        {
+            Token* p = x.params[j];
+            switch(p->t)
+            {
+                case RESULT:
+                {
+                    auto it = moved.find(p->getInt());
+                    if(it != moved.end())
+                        p->s = std::to_string(it->second);
+                    else
+                        invariant = false;
+                    break;
+                }
+                case CVAR: if(vars.count(p->getInt()) || !set[p->getInt()]) invariant = false; break;
+                case GVAR: if(anyGlobal || globals.count(p->getInt())) invariant = false; break;
+                case SVAR: if(anyGlobal || svars.count(p->getInt())) invariant = false; break;
+                case INT: case FLOAT: case STR: break;
+                default: invariant = false; break;
+            }
+        }
+        // the registers written here get a new value
+        if(x.hasResult && x.params.back()->t == RESULT)
+            moved.erase(x.params.back()->getInt());
+        if(x.op->t == COP && !x.params.empty() && x.params[0]->t == RESULT)
+            moved.erase(x.params[0]->getInt());
+        if(!invariant)
+            continue;
+        moved[x.params.back()->getInt()] = nreg;
+        x.params.back()->s = std::to_string(nreg);
+        ++nreg;
+        out.push_back(x);
+        out.back().loop = false;
+        out.back().release.clear();
+        if(x.loop && i+1 < ins.size())
+            ins[i+1].loop = true;
+        x.op = nullptr; // moved, not cleared
+        x.params.clear();
+        x.hasResult = false;
+        x.loop = false;
+    }
+    if(out.empty())
+        return 0;
+    compactInstructions(ins);
+    ins.insert(ins.begin()+head, out.begin(), out.end());
+    return out.size();
+}
+
+// loop invariant code motion, inner loops first (an instruction moved out of an inner loop can leave the outer one too)
+static size_t hoistInvariants(Code& func, const Compiled& code)
+{
+    std::vector<Instruction>& ins = func.line;
+    size_t nreg = 0;
+    for(auto &xi: ins)
+        for(auto &xj: xi.params)
+            if(xj->t == RESULT && (size_t)xj->getInt() + 1 > nreg)
+                nreg = xj->getInt() + 1;
+    size_t count = 0;
+    std::set<const Token*> done; // loops already processed
+    bool again = true;
+    while(again)
+    {
+        again = false;
+        for(size_t i = ins.size(); i-- > 0;)
+        {
+            if(ins[i].op->t != FUNC || ins[i].op->s != "while" || i+1 >= ins.size() || ins[i+1].op->t != LCUR)
+                continue;
+            if(!done.insert(ins[i].op).second)
+                continue;
+            size_t head = i;
+            while(head > 0 && !ins[head].loop) --head;
+            if(!ins[head].loop)
+                continue;
+            size_t n = hoistLoop(ins, head, i+1, blockEnd(ins, i+1), nreg, scalarValues(func, func.partial), func.var.size(), func.argn, code);
+            if(n)
+            {
+                count += n;
+                again = true;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+// live range of a register value
+struct Interval
+{
+    size_t start;
+    size_t end;
+    int reg = -1; // register after the allocation
+    bool pinned = false; // read before being written: kept for the whole function
+    bool extended = false; // stretched over a loop
+    bool str = false; // might hold a string
+};
+
+// liveness analysis and linear scan allocation of the registers (RESULT), sets func.creg to the minimum needed
+// a register holding a string is released after its last use (listed in Instruction::release)
+static void allocateRegisters(Code& func, const Compiled& code)
+{
+    std::vector<Instruction>& ins = func.line;
+    std::vector<Interval> iv;
+    std::map<int, size_t> current; // register -> live range of its current value
+    std::vector<std::pair<Token*, size_t> > uses; // every register token and its live range
+    std::vector<std::pair<size_t, size_t> > loops; // loop head and end
+    std::vector<size_t> jumps; // short-circuit jumps waiting for their end
+
+    for(size_t i = 0; i < ins.size(); ++i)
+    {
+        Instruction& x = ins[i];
+        if(x.op->t == LCUR || x.op->t == RCUR)
+            continue;
+        ins[i].release.clear();
+        int op = (x.op->t == COP ? x.op->getInt() : -1);
+        size_t n = x.params.size() - (x.hasResult ? 1 : 0);
+        // reads (the target of an assignment is read too, except for =)
+        for(size_t j = (op == 0 ? 1 : 0); j < n; ++j)
+        {
+            if(x.params[j]->t != RESULT) continue;
+            auto it = current.find(x.params[j]->getInt());
+            if(it == current.end())
+            {
+                iv.push_back(Interval());
+                iv.back().start = 0;
+                iv.back().end = ins.size();
+                iv.back().pinned = true;
+                it = current.insert({x.params[j]->getInt(), iv.size()-1}).first;
+            }
+            iv[it->second].end = i;
+            uses.push_back({x.params[j], it->second});
+        }
+        // the register written by a short-circuit jump is the one its final operation reads (or nothing if it doesn't read it anymore)
+        if(isShortCircuitJump(x))
+        {
+            jumps.push_back(i);
+            continue;
+        }
+        if(isShortCircuitEnd(x) && !jumps.empty())
+        {
+            Instruction& j = ins[jumps.back()];
+            jumps.pop_back();
+            if(j.hasResult)
+            {
+                auto it = current.end();
+                if(x.params[1]->t == RESULT && *(x.params[1]) == *(j.params.back()) && (it = current.find(x.params[1]->getInt())) != current.end())
+                    uses.push_back({j.params.back(), it->second});
+                else
+                {
+                    delete j.params.back();
+                    j.params.pop_back();
+                    j.hasResult = false;
+                }
+            }
+        }
+        // writes
+        std::vector<Token*> w;
+        if(x.hasResult) w.push_back(x.params.back());
+        if(op == 0 && !x.params.empty()) w.push_back(x.params[0]);
+        for(auto xj: w)
+        {
+            if(xj->t != RESULT) continue;
+            iv.push_back(Interval());
+            iv.back().start = i;
+            iv.back().end = i;
+            iv.back().str = (x.op->t == FUNC || op == 1 || op == 30 || op == 31 || (op == 0 && !x.params[1]->isNumber()));
+            current[xj->getInt()] = iv.size()-1;
+            uses.push_back({xj, iv.size()-1});
+        }
+        // loop limits
+        if(x.op->t == FUNC && x.op->s == "while" && i+1 < ins.size() && ins[i+1].op->t == LCUR)
+        {
+            size_t h = i;
+            while(h > 0 && !ins[h].loop) --h;
+            int depth = 0;
+            size_t e = i+1;
+            for(; e < ins.size(); ++e)
+            {
+                if(ins[e].op->t == LCUR) ++depth;
+                else if(ins[e].op->t == RCUR && --depth == 0) break;
+            }
+            loops.push_back({h, e});
+        }
+    }
+
+    // a value alive when entering a loop must stay alive until the loop end
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(auto &xi: iv)
+        {
+            if(xi.pinned) continue;
+            for(auto &xl: loops)
+            {
+                if(xi.start < xl.first && xl.first <= xi.end && xi.end < xl.second)
+                {
+                    xi.end = xl.second;
+                    xi.extended = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // linear scan (a register read by an instruction can receive its result)
+    std::vector<size_t> order(iv.size());
+    for(size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&iv](const size_t& a, const size_t& b) { return iv[a].start < iv[b].start; });
+    std::vector<size_t> active;
+    std::vector<bool> busy;
+    for(auto xi: order)
+    {
+        Interval& cur = iv[xi];
+        for(size_t k = 0; k < active.size();)
+        {
+            const Interval& old = iv[active[k]];
+            if(old.end < cur.start || (old.end == cur.start && old.start < cur.start))
+            {
+                busy[old.reg] = false;
+                active.erase(active.begin()+k);
+            }
+            else ++k;
+        }
+        size_t r = 0;
+        for(; r < busy.size(); ++r)
+            if(!busy[r])
+                break;
+        if(r == busy.size())
+            busy.push_back(false);
+        busy[r] = true;
+        cur.reg = r;
+        active.push_back(xi);
+    }
+    func.creg = busy.size();
+
+    for(auto &xi: uses)
+        xi.first->s = std::to_string(iv[xi.second].reg);
+
+    // release the strings at their last use, unless the instruction changes the current function
+    std::vector<std::vector<int> > defs(ins.size()); // registers written by each instruction
+    for(auto &xi: iv)
+        if(!xi.pinned)
+            defs[xi.start].push_back(xi.reg);
+    for(auto &xi: iv)
+    {
+        if(!xi.str || xi.pinned || xi.extended || xi.end == xi.start)
+            continue;
+        const Instruction& x = ins[xi.end];
+        if(x.op->t == FUNC && (code.find(x.op->s) != code.end() || x.op->s == "return"))
+            continue;
+        if(std::find(defs[xi.end].begin(), defs[xi.end].end(), xi.reg) == defs[xi.end].end()) // unless it receives a new value there
+            ins[xi.end].release.push_back(xi.reg);
+    }
+}
+
+// a function can be inlined if it's small, without blocks (so without loops or conditions) and ends with its only return
+// every local variable which isn't a parameter must be set before being read (an inlined function doesn't get a fresh frame)
+static bool isInlinable(const std::string& name, const Code& func)
+{
+    const std::vector<Instruction>& ins = func.line;
+    if(name.empty() || func.memo || ins.empty() || ins.size() > inline_limit) // an inlined memo function would lose its cache
+        return false;
+    const Instruction& last = ins.back();
+    if(last.op->t != FUNC || last.op->s != "return" || last.hasResult || last.params.size() != 1)
+        return false;
+    std::vector<size_t> r, w;
+    bool global;
+    std::set<size_t> set;
+    for(size_t i = 0; i < func.argn; ++i)
+        set.insert(i);
+    for(auto &xi: ins)
+    {
+        if(xi.op->t == LCUR || xi.op->t == RCUR)
+            return false;
+        if(xi.op->t == FUNC && &xi != &last && (xi.op->s == name || xi.op->s == "return" || xi.op->s == "break"))
+            return false;
+        instructionAccess(xi, func.var.size(), r, w, global);
+        for(auto xj: r)
+            if(xj < func.var.size() && !set.count(xj))
+                return false;
+        set.insert(w.begin(), w.end());
+    }
+    return true;
+}
+
+// copy of a callee token in the caller frame (args: value replacing each parameter, nullptr if it's copied to a variable)
+static Token* inlineToken(Token* p, const std::vector<Token*>& args, const size_t& vbase, const size_t& rbase)
+{
+    switch(p->t)
+    {
+        case CVAR:
+            if((size_t)p->getInt() < args.size() && args[p->getInt()])
+                return new Token(*args[p->getInt()]);
+            return new Token(std::to_string(vbase + p->getInt()), CVAR);
+        case RESULT: return new Token(std::to_string(rbase + p->getInt()), RESULT);
+        default: return new Token(*p);
+    }
+}
+
+// replaces the calls to small functions by their body, in the caller frame:
+// - a parameter is replaced by the call argument, unless the body modifies it or it's a global variable (copied with "=" to a variable appended to the caller frame)
+// - the registers are renumbered after the caller ones
+// - the return value goes to the call result (if any)
+// the inlined bodies are the ones before this pass (inlined code isn't inlined again)
+static size_t inlineCalls(Compiled& code)
+{
+    if(inline_limit == 0)
+        return 0;
+    std::map<std::string, std::vector<bool> > candidates; // and their parameters modified by the body
+    std::vector<size_t> r, w;
+    bool global;
+    for(auto &xi: code)
+    {
+        if(!isInlinable(xi.first, xi.second))
+            continue;
+        std::vector<bool>& written = candidates[xi.first];
+        written.resize(xi.second.argn, false);
+        for(auto &xj: xi.second.line)
+        {
+            instructionAccess(xj, xi.second.var.size(), r, w, global);
+            for(auto xk: w)
+                if(xk < written.size())
+                    written[xk] = true;
+        }
+    }
+    if(candidates.empty())
+        return 0;
+
+    size_t count = 0;
+    for(auto &xi: code)
+    {
+        Code& func = xi.second;
+        std::vector<Instruction>& ins = func.line;
+        bool any = false;
+        for(auto &xj: ins)
+            if(xj.op->t == FUNC && xj.op->s != xi.first && candidates.count(xj.op->s))
+                any = true;
+        if(!any)
+            continue;
+
+        size_t rbase = 0;
+        for(auto &xj: ins)
+            for(auto xk: xj.params)
+                if(xk->t == RESULT && (size_t)xk->getInt() + 1 > rbase)
+                    rbase = xk->getInt() + 1;
+        std::map<std::string, size_t> vbases; // where the variables of each inlined function start in the caller frame
+        size_t nvar = func.var.size();
+
+        std::vector<Instruction> out;
+        out.reserve(ins.size());
+        for(auto &xj: ins)
+        {
+            if(xj.op->t != FUNC || xj.op->s == xi.first || !candidates.count(xj.op->s))
+            {
+                out.push_back(xj);
+                continue;
+            }
+            Code& callee = code.at(xj.op->s);
+            auto vb = vbases.find(xj.op->s);
+            if(vb == vbases.end())
+            {
+                vb = vbases.insert({xj.op->s, func.var.size()}).first;
+                for(auto &xk: callee.var)
+                    func.var.push_back(xj.op->s + "." + xk); // can't collide with a script variable name
+            }
+            size_t vbase = vb->second;
+            size_t first = out.size();
+            const std::vector<bool>& written = candidates[xj.op->s];
+            std::vector<Token*> args(callee.argn, nullptr);
+            for(size_t k = 0; k < callee.argn; ++k)
+            {
+                if(!written[k] && xj.params[k]->t != GVAR && xj.params[k]->t != SVAR)
+                {
+                    args[k] = xj.params[k];
+                    continue;
+                }
+                out.push_back(Instruction());
+                out.back().op = new Token("0", COP);
+                out.back().params.push_back(new Token(std::to_string(vbase + k), CVAR));
+                out.back().params.push_back(xj.params[k]);
+                xj.params[k] = nullptr;
+            }
+            size_t rmax = 0;
+            for(size_t k = 0; k + 1 < callee.line.size(); ++k)
+            {
+                Instruction& y = callee.line[k];
+                out.push_back(Instruction());
+                out.back().op = new Token(*y.op);
+                out.back().hasResult = y.hasResult;
+                for(auto yp: y.params)
+                {
+                    out.back().params.push_back(inlineToken(yp, args, vbase, rbase));
+                    if(yp->t == RESULT && (size_t)yp->getInt() + 1 > rmax)
+                        rmax = yp->getInt() + 1;
+                }
+            }
+            if(xj.hasResult)
+            {
+                Token* v = callee.line.back().params[0];
+                if(v->t == RESULT && (size_t)v->getInt() + 1 > rmax)
+                    rmax = v->getInt() + 1;
+                Instruction* last = (out.size() > first ? &out.back() : nullptr);
+                if(v->t == RESULT && last && last->hasResult && last->params.back()->t == RESULT && (size_t)last->params.back()->getInt() == rbase + v->getInt())
+                {
+                    delete last->params.back(); // the last operation gives the returned value: it writes the call result directly
+                    last->params.back() = xj.params.back();
+                }
+                else
+                {
+                    out.push_back(Instruction());
+                    out.back().op = new Token("0", COP);
+                    out.back().params.push_back(xj.params.back());
+                    out.back().params.push_back(inlineToken(v, args, vbase, rbase));
+                }
+                xj.params.back() = nullptr;
+            }
+            rbase += rmax;
+            if(out.size() != first)
+                out[first].loop = xj.loop;
+            for(auto &xk: xj.params)
+                delete xk;
+            xj.params.clear();
+            xj.clear();
+            ++count;
+        }
+        ins.swap(out);
+
+        // drop the appended variables which aren't used (replaced parameters)
+        std::vector<int> ids(func.var.size() - nvar, -1);
+        for(auto &xj: ins)
+            for(auto xk: xj.params)
+                if(xk->t == CVAR && (size_t)xk->getInt() >= nvar)
+                    ids[xk->getInt() - nvar] = 0;
+        size_t n = nvar;
+        for(size_t j = 0; j < ids.size(); ++j)
+            if(ids[j] == 0)
+            {
+                func.var[n] = func.var[nvar + j];
+                ids[j] = n++;
+            }
+        func.var.resize(n);
+        for(auto &xj: ins)
+            for(auto xk: xj.params)
+                if(xk->t == CVAR && (size_t)xk->getInt() >= nvar)
+                    xk->s = std::to_string(ids[xk->getInt() - nvar]);
+    }
+    return count;
+}
+
+// the short-circuit jumps get their length (the final operation is a normal && or || at run time)
+static void finishShortCircuits(Code& func)
+{
+    std::vector<Instruction>& ins = func.line;
+    std::vector<size_t> jumps;
+    for(size_t i = 0; i < ins.size(); ++i)
+    {
+        if(isShortCircuitJump(ins[i]))
+            jumps.push_back(i);
+        else if(isShortCircuitEnd(ins[i]))
+        {
+            int op = ins[i].op->getInt();
+            delete ins[i].op;
+            ins[i].op = new Token(op == 28 ? "15" : "17", COP);
+            if(jumps.empty())
+                continue;
+            ins[jumps.back()].params[1]->s = std::to_string(i - jumps.back() - 1);
+            jumps.pop_back();
+        }
+    }
+}
+
+// optimizations on a function, once the inlining is done
+static void optimizeFunction(Code& func, const Compiled& code)
+{
+    foldConstants(func, code);
+    if(eliminateDeadCode(func, func.partial)) // the removed blocks can give new constants
+    {
+        foldConstants(func, code);
+        eliminateDeadCode(func, func.partial);
+    }
+    mergePureCalls(func);
+    hoistInvariants(func, code);
+    allocateRegisters(func, code);
+    finishShortCircuits(func);
+}
+
+bool Script::postprocessing(Compiled& code, ThreadPool& pool)
+{
+    summarizeGlobalWrites(code);
+    if(!checkMemo(code))
+        return false;
+    if(forEachFunction(code, pool, [&code](const std::string&, Code& func) -> int
+    {
+        return postprocessFunction(func, code) ? 0 : 1;
+    }) != 0)
+        return false;
+    inlineCalls(code);
+    inferScalarParams(code);
+    return forEachFunction(code, pool, [&code](const std::string&, Code& func) -> int
+    {
+        optimizeFunction(func, code);
+        return 0;
+    }) == 0;
+}
+
+bool Script::postprocessFunction(Code& func, const Compiled& code)
+{
+    std::vector<Instruction>& ins = func.line;
+    std::vector<std::pair<Token*, Token*> > replace;
+    size_t c;
+    size_t ri;
+    for(int i = 0; i < (int)ins.size(); ++i)
+    {
+        // Instruction()
+        switch(ins[i].op->t)
+        {
+            case FUNC:
+            {
+                auto ast = code.find(ins[i].op->s);
+                if(ast != code.end())
+                    c = ast->second.argn;
+                else
+                {
+                    auto bst = gl_func.find(ins[i].op->s);
+                    if(bst == gl_func.end()) return false;
+                    c = bst->second;
+                }
+                break;
+            }
+            case OPERATOR:
+                if(isSingleOp(ins[i].op->s) || (ins[i].op->s == "-" && ins[i].op->o == PREFIX))
+                    c = 1;
+                else if(ins[i].op->s == "[]=")
+                    c = 3;
+                else c = 2;
+                break;
+            case LCUR: case RCUR:
+                continue;
+            default:
+                return false;
+        }
+        if((ins[i].hasResult && ins[i].params.size() != c + 1) ||
+           (!ins[i].hasResult && ins[i].params.size() != c))
+            return false;
+
+        for(size_t j = 0; j < c; ++j)
+        {
+            for(ri = 0; ri < replace.size(); ++ri)
+                if(*(replace[ri].first) == *(ins[i].params[j]))
+                    break;
+            if(ri != replace.size())
+            {
+                delete ins[i].params[j];
+                ins[i].params[j] = new Token(*(replace[ri].second));
+                delete replace[ri].first;
+                delete replace[ri].second;
+                replace.erase(replace.begin()+ri);
+            }
+        }
+        if(ins[i].hasResult)
+        {
+            for(ri = 0; ri < replace.size(); ++ri)
+                if(*(replace[ri].first) == *(ins[i].params[c]))
+                    break;
+            if(ri != replace.size())
+            {
+                delete replace[ri].first;
+                delete replace[ri].second;
+                replace.erase(replace.begin()+ri);
+            }
+        }
+
+        switch(ins[i].op->t)
+        {
+            case OPERATOR:
+                if(ins[i].op->s == "=")
+                {
+                    int pzt = ins[i].params[0]->t;
+                    if(!ins[i].hasResult && (pzt != VAR && pzt != RESULT && pzt != GVAR && pzt != SVAR))
+                    {
+                        ins[i].clear();
+                        removeInstruction(ins, i);
+                        break;
+                    }
+                    else if(ins[i].hasResult && (pzt == VAR || pzt == RESULT || pzt == GVAR || pzt == SVAR))
+                    {
+                        replace.push_back({ins[i].params[2], new Token(*(ins[i].params[0]))});
+                        ins[i].params.pop_back();
+                        ins[i].hasResult = false;
+                    }
+                    if(!ins[i].hasResult && (pzt == VAR || pzt == RESULT || pzt == GVAR || pzt == SVAR) && ins[i].params[1]->t == RESULT)
                     {
-                        size_t id = 0;
-                        for(; id < func.var.size(); ++id)
+                        for(int j = i - 1; j >= 0; --j)
                         {
-                            if(func.var[id] == xk->s)
+                            if(ins[j].hasResult && *(ins[j].params.back()) == *(ins[i].params[1]))
+                            {
+                                delete ins[j].params[ins[j].params.size()-1];
+                                ins[j].params[ins[j].params.size()-1] = ins[i].params[0];
+                                ins[i].params[0] = nullptr;
+                                ins[i].clear();
+                                removeInstruction(ins, i);
                                 break;
+                            }
+
                         }
-                        if(id != func.var.size())
+                    }
+                }
+                else if(ins[i].op->s == "-" && ins[i].op->o == PREFIX)
+                {
+                    if(ins[i].hasResult)
+                    {
+                        if(ins[i].params[0]->isNumber())
                         {
-                            delete xk;
-                            xk = new Token(std::to_string(id), CVAR);
+                            ins[i].params[0]->inverseSign();
+                            replace.push_back({ins[i].params[1], ins[i].params[0]});
+                            ins[i].params.clear();
+                            ins[i].clear();
+                            removeInstruction(ins, i);
                         }
-                        break;
                     }
-                    case RESULT:
-                        if(xk->getInt()+1 > (int)func.creg)
-                            func.creg = xk->getInt()+1;
-                        break;
+                    else
+                    {
+                        ins[i].clear();
+                        removeInstruction(ins, i);
+                    }
+                }
+                else // +=, -=, etc... NOT != and ==
+                {
+                    std::string tmp = ins[i].op->s;
+                    if(tmp.size() == 2 && tmp[1] == '=' && tmp[0] != '!' && tmp[0] != '=' && tmp[0] != '>' && tmp[0] != '<')
+                    {
+                        int pzt = ins[i].params[0]->t;
+                        if(ins[i].hasResult && (pzt == VAR || pzt == RESULT || pzt == GVAR || pzt == SVAR))
+                        {
+                            replace.push_back({ins[i].params[2], new Token(*(ins[i].params[0]))});
+                            ins[i].params.pop_back();
+                            ins[i].hasResult = false;
+                        }
+                    }
+                }
+                break;
+            default:
+                continue;
+        }
+    }
+    for(auto r: replace)
+        delete r.first;
+    compactInstructions(ins);
+    for(auto &xj: func.line)
+    {
+        switch(xj.op->t)
+        {
+            case FUNC: // builtins run as operations (has, remove), unless a host function replaced them
+                if(op_unordered_map.find(xj.op->s) == op_unordered_map.end() || !gl_builtin.count(xj.op->s))
+                    break;
+                // nobreak
+            case OPERATOR:
+            {
+                Token *tmp = new Token(std::to_string(op_unordered_map.at(xj.op->s)), COP);
+                delete xj.op;
+                xj.op = tmp;
+                break;
+            }
+            default:
+                break;
+        }
+        for(auto &xk: xj.params)
+        {
+            switch(xk->t)
+            {
+                case VAR:
+                {
+                    size_t id = 0;
+                    for(; id < func.var.size(); ++id)
+                    {
+                        if(func.var[id] == xk->s)
+                            break;
+                    }
+                    if(id != func.var.size())
+                    {
+                        delete xk;
+                        xk = new Token(std::to_string(id), CVAR);
+                    }
+                    break;
                 }
             }
         }
     }
+    lowerShortCircuits(func);
     return true;
 }
 
-bool Script::save(const std::string& output, const Compiled& code)
+bool Script::save(std::ostream& o, const Compiled& code)
+{
+    std::vector<std::pair<std::string, size_t> > table;
+    for(auto &xi: code)
+        table.push_back({xi.first, xi.second.argn});
+    saveHeader(o, table, code.find("")->second.svar.size());
+    for(auto &xi: code)
+        saveFunction(o, xi.second);
+    return o.good();
+}
+
+void Script::saveHeader(std::ostream& o, const std::vector<std::pair<std::string, size_t> >& table, const size_t& svarn)
 {
-    // tmp vars used during the writing
     size_t tmp;
-    float fv;
-    std::string buf;
 
     // saving the result
     // (file format subject to change)
-    // output file
-    std::ofstream o(output, std::ios::out | std::ios::trunc | std::ios::binary);
-    if(!o)
-        return false;
     tmp = SCRIPT_MAGIC;
     o.write((char*)&tmp, 4);
-    tmp = code.size();
+    tmp = svarn; // script variable count
     o.write((char*)&tmp, 4);
-    for(auto &xi: code)
+    tmp = table.size();
+    o.write((char*)&tmp, 4);
+    for(auto &xi: table) // function names and parameter counts (the function bodies follow in the same order)
     {
         tmp = xi.first.size();
         o.write((char*)&tmp, 4);
         if(tmp) o.write(xi.first.c_str(), tmp);
-        tmp = xi.second.argn;
+        tmp = xi.second;
         o.write((char*)&tmp, 4);
     }
-    for(auto &xi: code)
+}
+
+void Script::saveFunction(std::ostream& o, const Code& func)
+{
+    size_t tmp;
+
+    tmp = func.creg;
+    o.write((char*)&tmp, 4);
+    tmp = func.var.size();
+    o.write((char*)&tmp, 4);
+    tmp = func.memo; // flags
+    o.write((char*)&tmp, 4);
+    tmp = func.line.size();
+    o.write((char*)&tmp, 4);
+    saveLines(o, func.line);
+}
+
+void Script::saveLines(std::ostream& o, const std::vector<Instruction>& lines)
+{
+    // tmp vars used during the writing
+    size_t tmp;
+    float fv;
+    std::string buf;
+
+    for(auto &xj: lines)
     {
-        const Code& func = xi.second;
+        tmp = xj.op->t;
+        o.write((char*)&tmp, 1);
+        if(xj.op->isIntValue())
+        {
+            tmp = xj.op->getInt();
+            o.write((char*)&tmp, 4);
+        }
+        else if(xj.op->isFloatValue())
+        {
+            fv = xj.op->getFloat();
+            o.write((char*)&fv, 4);
+        }
+        else
+        {
+            if(xj.op->isStringValue()) buf = xj.op->getStrippedString();
+            else buf = xj.op->s;
+            tmp = buf.size();
+            o.write((char*)&tmp, 4);
+            if(tmp) o.write(buf.c_str(), tmp);
+        }
 
-        tmp = func.creg;
-        o.write((char*)&tmp, 4);
-        tmp = func.var.size();
-        o.write((char*)&tmp, 4);
-        tmp = func.line.size();
+        o.write((char*)&(xj.hasResult), 1);
+        tmp = (xj.loop ? 1 : 0) | (xj.release.empty() ? 0 : 2); // flags
+        o.write((char*)&tmp, 1);
+        if(!xj.release.empty()) // registers to free after this instruction
+        {
+            tmp = xj.release.size();
+            o.write((char*)&tmp, 4);
+            for(auto &xk: xj.release)
+            {
+                tmp = xk;
+                o.write((char*)&tmp, 4);
+            }
+        }
+        tmp = xj.params.size();
         o.write((char*)&tmp, 4);
 
-        for(auto &xj: func.line)
+        for(auto &xk: xj.params)
         {
-            tmp = xj.op->t;
+            tmp = xk->t;
             o.write((char*)&tmp, 1);
-            if(xj.op->isIntValue())
+            if(xk->isIntValue())
             {
-                tmp = xj.op->getInt();
+                tmp = xk->getInt();
                 o.write((char*)&tmp, 4);
             }
-            else if(xj.op->isFloatValue())
+            else if(xk->isFloatValue())
             {
-                fv = xj.op->getFloat();
+                fv = xk->getFloat();
                 o.write((char*)&fv, 4);
             }
             else
             {
-                if(xj.op->isStringValue()) buf = xj.op->getStrippedString();
-                else buf = xj.op->s;
+                if(xk->isStringValue()) buf = xk->getStrippedString();
+                else buf = xk->s;
                 tmp = buf.size();
                 o.write((char*)&tmp, 4);
                 if(tmp) o.write(buf.c_str(), tmp);
             }
-
-            o.write((char*)&(xj.hasResult), 1);
-            tmp = xj.params.size();
-            o.write((char*)&tmp, 4);
-
-            for(auto &xk: xj.params)
-            {
-                tmp = xk->t;
-                o.write((char*)&tmp, 1);
-                if(xk->isIntValue())
-                {
-                    tmp = xk->getInt();
-                    o.write((char*)&tmp, 4);
-                }
-                else if(xk->isFloatValue())
-                {
-                    fv = xk->getFloat();
-                    o.write((char*)&fv, 4);
-                }
-                else
-                {
-                    if(xk->isStringValue()) buf = xk->getStrippedString();
-                    else buf = xk->s;
-                    tmp = buf.size();
-                    o.write((char*)&tmp, 4);
-                    if(tmp) o.write(buf.c_str(), tmp);
-                }
-            }
         }
     }
-    return true;
 }
 
 void Script::print(Compiled& code)
@@ -1963,9 +5247,11 @@ void Script::print(Compiled& code)
         for(auto xj: code[xi.first].line)
         {
             std::cout << xl << " -> ";
+            if(xj.loop) std::cout << "(loop) ";
             ++xl;
             if(xj.op->t == RESULT) std::cout << "r" << xj.op->getInt() << " ";
             else if(xj.op->t == GVAR) std::cout << "@" << xj.op->getInt() << " ";
+            else if(xj.op->t == SVAR) std::cout << "$" << xj.op->getInt() << " ";
             else if(xj.op->t == CVAR) std::cout << "v" << xj.op->getInt() << " ";
             else if(xj.op->isIntValue()) std::cout << xj.op->getInt() << " ";
             else if(xj.op->isFloatValue()) std::cout << xj.op->getFloat() << " ";
@@ -1975,11 +5261,14 @@ void Script::print(Compiled& code)
             {
                 if(j->t == RESULT) std::cout << "r" << j->getInt() << " ";
                 else if(j->t == GVAR) std::cout << "@" << j->getInt() << " ";
+                else if(j->t == SVAR) std::cout << "$" << j->getInt() << " ";
                 else if(j->t == CVAR) std::cout << "v" << j->getInt() << " ";
                 else if(j->isIntValue()) std::cout << j->getInt() << " ";
                 else if(j->isFloatValue()) std::cout << j->getFloat() << " ";
                 else std::cout << j->s << " ";
             }
+            for(auto j: xj.release)
+                std::cout << "(free r" << j << ") ";
             std::cout << std::endl;
         }
         std::cout << std::endl;
@@ -2007,6 +5296,130 @@ void Script::debug(Program& code)
     }
 }
 
+static bool compareInt(const int& op, const int& a, const int& b)
+{
+    switch(op)
+    {
+        case 6: return (a != b);
+        case 7: return (a > b);
+        case 8: return (a < b);
+        case 9: return (a >= b);
+        case 10: return (a <= b);
+        default: return (a == b);
+    }
+}
+
+// superinstructions (see fuseLines()): fast path for INT values, anything else goes through operation()
+void Script::fusedOperation(Line& line)
+{
+    int op_id = *(line.op.get<int>());
+    int fuse = line.fuse;
+    if(fuse == FUSE_SWITCH)
+    {
+        const JumpTable& table = code[id].switch_map[pc];
+        int t;
+        const void* u = getValueContent(line.params[table.param], t);
+        if(t == INT)
+        {
+            auto it = table.arms.find(*(const int*)u);
+            if(it != table.arms.end()) // enter the block, as if the conditions before it were false
+            {
+                pc = it->second;
+                enterBlock(false);
+            }
+            else // after the chain, an else can follow
+            {
+                pc = table.other;
+                canElse = true;
+            }
+            return;
+        }
+        fuse = FUSE_IF; // the other types are compared one block at a time
+    }
+    switch(fuse)
+    {
+        case FUSE_IF: case FUSE_ELIF: case FUSE_WHILE:
+        {
+            Line& next = code[id].line[pc+1];
+            int t[2];
+            const void* u[2] = {getValueContent(line.params[0], t[0]), getValueContent(line.params[1], t[1])};
+            if(t[0] == INT && t[1] == INT)
+            {
+                bool r = compareInt(op_id, *(const int*)u[0], *(const int*)u[1]);
+                currentRegs[*(line.params[2].get<int>())].set((int)r); // the register keeps its value, like with two lines
+                ++pc;
+                branch(fuse, r);
+            }
+            else
+            {
+                operation(line);
+                if(state != PLAY)
+                    return;
+                ++pc;
+                (*(next.op.get<CallRef>()))->second(this, next);
+            }
+            for(auto &i: next.release)
+                if(currentRegs[i].getType() == STR || currentRegs[i].getType() == ARRAY || currentRegs[i].getType() == DICT)
+                    currentRegs[i].clear();
+            break;
+        }
+        case FUSE_INC: case FUSE_INC_END: case FUSE_FOR:
+        {
+            Value& v = currentVars[*(line.params[0].get<int>())];
+            if(v.getType() == INT)
+            {
+                int k = ((op_id == 18 || op_id == 19) ? 1 : *(line.params[1].get<int>()));
+                if(op_id == 2 || op_id == 19 || op_id == 21) k = -k;
+                v.set(*(v.get<int>()) + k);
+            }
+            else
+            {
+                operation(line);
+                if(state != PLAY)
+                    return;
+            }
+            if(line.fuse == FUSE_INC_END)
+            {
+                ++pc;
+                endBlock();
+            }
+            else if(line.fuse == FUSE_FOR)
+            {
+                ++pc;
+                if(!ifstack.empty() && ifstack.top().scope + 1 == scope)
+                {
+                    // the loop comparison, without going back to it: the loop stays entered while it's true
+                    const int head = ifstack.top().pc + 1;
+                    const Line& cmp = code[id].line[head];
+                    int t[2];
+                    const void* u[2] = {getValueContent(cmp.params[0], t[0]), getValueContent(cmp.params[1], t[1])};
+                    if(t[0] == INT && t[1] == INT)
+                    {
+                        bool r = compareInt(*(cmp.op.get<int>()), *(const int*)u[0], *(const int*)u[1]);
+                        currentRegs[*(cmp.params[2].get<int>())].set((int)r);
+                        canElse = false;
+                        if(r)
+                        {
+                            pc = head + 2; // the block start
+                        }
+                        else
+                        {
+                            ifstack.pop();
+                            --scope;
+                        }
+                        break;
+                    }
+                }
+                endBlock();
+            }
+            break;
+        }
+        default:
+            operation(line);
+            break;
+    }
+}
+
 void Script::operation(Line& line)
 {
     int op_id = *(line.op.get<int>());
@@ -2021,6 +5434,12 @@ void Script::operation(Line& line)
 
     switch(op_id)
     {
+        case 30: case 31:
+            arrayOperation(line);
+            return;
+        case 32: case 33:
+            dictOperation(line);
+            return;
         case 0:
             n = 1;
             equal = true;
@@ -2067,6 +5486,16 @@ void Script::operation(Line& line)
             ttype = line.params.back().getType();
             V[0] = &line.params[0];
             break;
+        case 26: case 27:
+            n = 1;
+            if(line.hasResult)
+            {
+                target = line.params.back().get<int>();
+                ttype = line.params.back().getType();
+            }
+            else target = nullptr;
+            V[0] = &line.params[0];
+            break;
         case 18: case 19:
             n = 1;
             if(line.hasResult)
@@ -2087,6 +5516,21 @@ void Script::operation(Line& line)
 
     for(int i = 0; i < n; ++i)
         u[i] = getValueContent(*V[i], t[i]);
+    if(n == 2 && (op_id == 6 || op_id == 11) && (t[0] == DICT || t[1] == DICT)) // dictionaries are compared as a whole
+    {
+        Value x, y;
+        x.share(u[0], t[0]);
+        y.share(u[1], t[1]);
+        setVar(*target, (int)((x == y) == (op_id == 11)), ttype);
+        x.clear();
+        y.clear();
+        return;
+    }
+    if(n == 2 && (t[0] == ARRAY || t[1] == ARRAY)) // element by element
+    {
+        vectorOperation(op_id, V, *target, ttype);
+        return;
+    }
 
     switch(op_id)
     {
@@ -2095,7 +5539,14 @@ void Script::operation(Line& line)
             {
                 case INT: setVar(*target, *(const int*)u[0], ttype); break;
                 case FLOAT: setVar(*target, *(const float*)u[0], ttype); break;
-                case STR: setVar(*target, *(const std::string*)u[0], ttype); break;
+                case STR: case ARRAY: case DICT:
+                    if(V[0]->getType() == RESULT && std::find(line.release.begin(), line.release.end(), *(V[0]->get<int>())) != line.release.end())
+                    {
+                        if(!getVar(line.params[0]).move(getVar(*V[0]))) // last read of the register
+                            setError("set(Value) error");
+                    }
+                    else setVar(*target, *V[0], ttype); // shares the content
+                    break;
                 default: goto op_ins_error;
             }
             break;
@@ -2121,14 +5572,28 @@ void Script::operation(Line& line)
                     }
                     break;
                 case STR:
+                {
+                    std::string* self = nullptr; // s = s + x or s += x: appended in place if the text isn't shared (the capacity growth makes a loop linear)
+                    if(V[0]->getType() == ttype && *(V[0]->get<int>()) == *target && static_cast<const SharedString*>((const std::string*)u[0])->refs == 1)
+                        self = (std::string*)u[0];
                     switch(t[1])
                     {
-                        case INT: setVar(*target, *(const std::string*)u[0] + std::to_string(*(const int*)u[1]), ttype); break;
-                        case FLOAT: setVar(*target, *(const std::string*)u[0] + std::to_string(*(const float*)u[1]), ttype); break;
-                        case STR: setVar(*target, *(const std::string*)u[0] + *(const std::string*)u[1], ttype); break;
+                        case INT:
+                            if(self) self->append(std::to_string(*(const int*)u[1]));
+                            else setVar(*target, *(const std::string*)u[0] + std::to_string(*(const int*)u[1]), ttype);
+                            break;
+                        case FLOAT:
+                            if(self) self->append(std::to_string(*(const float*)u[1]));
+                            else setVar(*target, *(const std::string*)u[0] + std::to_string(*(const float*)u[1]), ttype);
+                            break;
+                        case STR:
+                            if(self) self->append(*(const std::string*)u[1]);
+                            else setVar(*target, *(const std::string*)u[0] + *(const std::string*)u[1], ttype);
+                            break;
                         default: goto op_ins_error;
                     }
                     break;
+                }
                 default: goto op_ins_error;
             }
             break;
@@ -2272,7 +5737,7 @@ void Script::operation(Line& line)
                     {
                         case INT: setVar(*target, 0, ttype); break;
                         case FLOAT: setVar(*target, 0, ttype); break;
-                        case STR: setVar(*target, *(const std::string*)u[0] != *(const std::string*)u[1], ttype); break;
+                        case STR: setVar(*target, u[0] != u[1] && *(const std::string*)u[0] != *(const std::string*)u[1], ttype); break;
                         default: goto op_ins_error;
                     }
                     break;
@@ -2437,7 +5902,7 @@ void Script::operation(Line& line)
                     {
                         case INT: setVar(*target, 0, ttype); break;
                         case FLOAT: setVar(*target, 0, ttype); break;
-                        case STR: setVar(*target, *(const std::string*)u[0] == *(const std::string*)u[1], ttype); break;
+                        case STR: setVar(*target, u[0] == u[1] || *(const std::string*)u[0] == *(const std::string*)u[1], ttype); break;
                         default: goto op_ins_error;
                     }
                     break;
@@ -2612,141 +6077,786 @@ void Script::operation(Line& line)
                 default: goto op_ins_error;
             }
             break;
+        case 26: case 27: // jump over the right operand of && (left operand false) or || (left operand true)
+        {
+            bool r;
+            switch(t[0])
+            {
+                case INT: r = (*(const int*)u[0] != 0); break;
+                case FLOAT: r = (*(const float*)u[0] != 0.f); break;
+                case STR: r = !((const std::string*)u[0])->empty(); break;
+                default: goto op_ins_error;
+            }
+            if(r == (op_id == 27))
+            {
+                if(target) setVar(*target, 0, ttype); // the right operand register, read by the && or || operation
+                pc += *(line.params[1].get<int>());
+            }
+            break;
+        }
         default:
             goto op_ins_error;
     }
 
-    return;
-op_ins_error:
-    setError("malformed operation");
-    return;
-op_div_error:
-    setError("division by zero");
-    return;
+    return;
+op_ins_error:
+    setError("malformed operation");
+    return;
+op_div_error:
+    setError("division by zero");
+    return;
+}
+
+// "[]" a i r: element (or character) i of a in r
+// "[]=" a i v [r]: sets the element i of a to v (i == size appends), the array is copied first if it's shared
+void Script::arrayOperation(Line& line)
+{
+    int t, ti;
+    const void* u = getValueContent(line.params[0], t);
+    Array* a;
+    float fv;
+    if(t == DICT)
+    {
+        dictOperation(line);
+        return;
+    }
+    const void* pi = getValueContent(line.params[1], ti);
+    if(ti != INT) { setError("array index must be an integer"); return; }
+    const int k = *(const int*)pi;
+    const Value& r = line.params.back();
+
+    if(*(line.op.get<int>()) == 30)
+    {
+        if(t == STR)
+        {
+            const std::string& str = *(const std::string*)u;
+            if(k < 0 || k >= (int)str.size()) goto array_range_error;
+            setVar(*r.get<int>(), std::string(1, str[k]), r.getType());
+            return;
+        }
+        if(t != ARRAY) goto array_type_error;
+        const Array& src = *(const Array*)u;
+        if(k < 0 || k >= (int)src.size()) goto array_range_error;
+        switch(src.type) // the result register might hold the array itself: the element is copied first
+        {
+            case INT: { int x = src.i[k]; setVar(*r.get<int>(), x, r.getType()); break; }
+            case FLOAT: { float x = src.f[k]; setVar(*r.get<int>(), x, r.getType()); break; }
+            default:
+            {
+                Value x;
+                x.share(src.v[k].getP(), src.v[k].getType());
+                setVar(*r.get<int>(), x, r.getType());
+                x.clear();
+                break;
+            }
+        }
+        return;
+    }
+
+    a = getVar(line.params[0]).modifyArray();
+    if(!a) goto array_type_error;
+    if(k < 0 || k > (int)a->size()) goto array_range_error;
+    u = getValueContent(line.params[2], t);
+    if(t != INT && t != FLOAT && t != STR && t != ARRAY && t != DICT) goto array_type_error;
+    if(a->type != TBD && a->type != t && a->size() == 0 && (t == INT || t == FLOAT)) // an empty array takes the type of its first element
+        a->type = t;
+    if(a->type == INT && t == FLOAT) // a float in an int array: it becomes a float array
+    {
+        a->f.assign(a->i.begin(), a->i.end());
+        std::vector<int>().swap(a->i);
+        a->type = FLOAT;
+    }
+    if(a->type == FLOAT && t == INT) // and an int in a float array is stored as a float
+    {
+        fv = (float)*(const int*)u;
+        u = &fv;
+        t = FLOAT;
+    }
+    if(a->type != TBD && a->type != t) // mixed types: the elements are boxed from now on
+    {
+        a->v.resize(a->size());
+        for(size_t j = 0; j < a->v.size(); ++j)
+        {
+            if(a->type == INT) a->v[j].set(a->i[j]);
+            else a->v[j].set(a->f[j]);
+        }
+        std::vector<int>().swap(a->i);
+        std::vector<float>().swap(a->f);
+        a->type = TBD;
+    }
+    switch(a->type)
+    {
+        case INT:
+            if(k == (int)a->i.size()) a->i.push_back(*(const int*)u);
+            else a->i[k] = *(const int*)u;
+            break;
+        case FLOAT:
+            if(k == (int)a->f.size()) a->f.push_back(*(const float*)u);
+            else a->f[k] = *(const float*)u;
+            break;
+        default:
+        {
+            Array* c = (u == a ? new Array(*a) : nullptr); // a[i] = a: stores a copy (made before the append), an array can't contain itself
+            if(k == (int)a->v.size()) a->v.push_back(Value());
+            if(c) a->v[k].set(c, ARRAY);
+            else a->v[k].share(u, t);
+            break;
+        }
+    }
+    if(line.hasResult)
+        setVar(*r.get<int>(), line.params[2], r.getType());
+    return;
+array_type_error:
+    setError("indexing a value which isn't an array");
+    return;
+array_range_error:
+    setError("array index out of range (" + std::to_string(k) + ")");
+    return;
+}
+
+// "[]" d k r: value of the key k in r, "[]=" d k v [r]: sets it (the dictionary is copied first if it's shared)
+// "has" d k r: 1 if d has the key k, "remove" d k [r]: removes it (r: 1 if it was there)
+void Script::dictOperation(Line& line)
+{
+    const int op = *(line.op.get<int>());
+    const Value& r = line.params.back();
+    int t, tk;
+    const void* u;
+    const void* key = getValueContent(line.params[1], tk);
+    if(tk != INT && tk != STR)
+    {
+        setError("a dictionary key must be an integer or a string");
+        return;
+    }
+    switch(op)
+    {
+        case 30: case 32:
+        {
+            u = getValueContent(line.params[0], t);
+            if(t != DICT) goto dict_type_error;
+            const Value* v = ((const Dict*)u)->find(key, tk);
+            if(op == 32)
+            {
+                if(line.hasResult) setVar(*r.get<int>(), (int)(v != nullptr), r.getType());
+                return;
+            }
+            if(!v) goto dict_key_error;
+            switch(v->getType()) // the result register might hold the dictionary itself: the value is copied first
+            {
+                case INT: { int x = *v->get<int>(); setVar(*r.get<int>(), x, r.getType()); break; }
+                case FLOAT: { float x = *v->get<float>(); setVar(*r.get<int>(), x, r.getType()); break; }
+                default:
+                {
+                    Value x;
+                    x.share(v->getP(), v->getType());
+                    setVar(*r.get<int>(), x, r.getType());
+                    x.clear();
+                    break;
+                }
+            }
+            return;
+        }
+        default:
+        {
+            Dict* d = getVar(line.params[0]).modifyDict();
+            if(!d) goto dict_type_error;
+            if(op == 33)
+            {
+                bool removed = d->erase(key, tk);
+                if(line.hasResult) setVar(*r.get<int>(), (int)removed, r.getType());
+                return;
+            }
+            u = getValueContent(line.params[2], t);
+            if(t != INT && t != FLOAT && t != STR && t != ARRAY && t != DICT) goto dict_type_error;
+            Dict* c = (u == d ? new Dict(*d) : nullptr); // d[k] = d: stores a copy, a dictionary can't contain itself
+            Value* v = d->insert(key, tk);
+            if(c) v->set(c, DICT);
+            else v->share(u, t);
+            if(line.hasResult)
+                setVar(*r.get<int>(), line.params[2], r.getType());
+            return;
+        }
+    }
+dict_type_error:
+    setError("not a dictionary, or a value which can't be stored");
+    return;
+dict_key_error:
+    if(tk == INT) setError("key not found (" + std::to_string(*(const int*)key) + ")");
+    else setError("key not found (" + *(const std::string*)key + ")");
+    return;
+}
+
+// whole array kernels (op: 0 + 1 - 2 * 3 / 4 < 5 > 6 <= 7 >= 8 == 9 !=, comparisons give 0 or 1 in an int buffer)
+// an operand with a step of 0 is a number, used for every element
+// the SSE2 or AVX2 version (chosen at run time) processes the bulk of the elements and returns where it stopped, the scalar loop does the rest
+enum {VEC_SCALAR, VEC_SSE2, VEC_AVX2};
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define SCRIPT_SIMD
+#include <immintrin.h>
+
+static int simdLevel()
+{
+    static const int level = (__builtin_cpu_supports("avx2") ? VEC_AVX2 : VEC_SSE2); // SSE2 is always there on x86-64
+    return level;
+}
+
+// r = a op b, W elements at a time (LOAD/STORE: intrinsics of the type, EXPR: operation on x and y)
+#define VEC_LOOP(W, T, LOADA, LOADB, EXPR, STORE) \
+    for(; k + W <= n; k += W) \
+    { \
+        T x = (as ? LOADA(a + k) : va); \
+        T y = (bs ? LOADB(b + k) : vb); \
+        STORE(EXPR); \
+    } \
+    break;
+
+__attribute__((target("avx2"))) static size_t avx2Kernel(const int& op, const float* a, const size_t& as, const float* b, const size_t& bs, void* r, const size_t& n)
+{
+    size_t k = 0;
+    const __m256 va = _mm256_set1_ps(*a), vb = _mm256_set1_ps(*b);
+    const __m256i one = _mm256_set1_epi32(1);
+    float* rf = (float*)r;
+    int* ri = (int*)r;
+    #define STF(e) _mm256_storeu_ps(rf + k, e)
+    #define STI(e) _mm256_storeu_si256((__m256i*)(ri + k), _mm256_and_si256(_mm256_castps_si256(e), one))
+    switch(op)
+    {
+        case 0: VEC_LOOP(8, __m256, _mm256_loadu_ps, _mm256_loadu_ps, _mm256_add_ps(x, y), STF)
+        case 1: VEC_LOOP(8, __m256, _mm256_loadu_ps, _mm256_loadu_ps, _mm256_sub_ps(x, y), STF)
+        case 2: VEC_LOOP(8, __m256, _mm256_loadu_ps, _mm256_loadu_ps, _mm256_mul_ps(x, y), STF)
+        case 3: VEC_LOOP(8, __m256, _mm256_loadu_ps, _mm256_loadu_ps, _mm256_div_ps(x, y), STF)
+        case 4: VEC_LOOP(8, __m256, _mm256_loadu_ps, _mm256_loadu_ps, _mm256_cmp_ps(x, y, _CMP_LT_OQ), STI)
+        case 5: VEC_LOOP(8, __m256, _mm256_loadu_ps, _mm256_loadu_ps, _mm256_cmp_ps(x, y, _CMP_GT_OQ), STI)
+        case 6: VEC_LOOP(8, __m256, _mm256_loadu_ps, _mm256_loadu_ps, _mm256_cmp_ps(x, y, _CMP_LE_OQ), STI)
+        case 7: VEC_LOOP(8, __m256, _mm256_loadu_ps, _mm256_loadu_ps, _mm256_cmp_ps(x, y, _CMP_GE_OQ), STI)
+        case 8: VEC_LOOP(8, __m256, _mm256_loadu_ps, _mm256_loadu_ps, _mm256_cmp_ps(x, y, _CMP_EQ_OQ), STI)
+        case 9: VEC_LOOP(8, __m256, _mm256_loadu_ps, _mm256_loadu_ps, _mm256_cmp_ps(x, y, _CMP_NEQ_UQ), STI)
+        default: break;
+    }
+    #undef STF
+    #undef STI
+    return k;
+}
+
+__attribute__((target("avx2"))) static size_t avx2Kernel(const int& op, const int* a, const size_t& as, const int* b, const size_t& bs, void* r, const size_t& n)
+{
+    size_t k = 0;
+    const __m256i va = _mm256_set1_epi32(*a), vb = _mm256_set1_epi32(*b);
+    const __m256i one = _mm256_set1_epi32(1);
+    int* ri = (int*)r;
+    #define LDI(p) _mm256_loadu_si256((const __m256i*)(p))
+    #define STV(e) _mm256_storeu_si256((__m256i*)(ri + k), e)
+    #define STT(e) STV(_mm256_and_si256(e, one)) // true where the mask is set
+    #define STN(e) STV(_mm256_andnot_si256(e, one)) // true where it isn't
+    switch(op)
+    {
+        case 0: VEC_LOOP(8, __m256i, LDI, LDI, _mm256_add_epi32(x, y), STV)
+        case 1: VEC_LOOP(8, __m256i, LDI, LDI, _mm256_sub_epi32(x, y), STV)
+        case 2: VEC_LOOP(8, __m256i, LDI, LDI, _mm256_mullo_epi32(x, y), STV)
+        case 4: VEC_LOOP(8, __m256i, LDI, LDI, _mm256_cmpgt_epi32(y, x), STT)
+        case 5: VEC_LOOP(8, __m256i, LDI, LDI, _mm256_cmpgt_epi32(x, y), STT)
+        case 6: VEC_LOOP(8, __m256i, LDI, LDI, _mm256_cmpgt_epi32(x, y), STN)
+        case 7: VEC_LOOP(8, __m256i, LDI, LDI, _mm256_cmpgt_epi32(y, x), STN)
+        case 8: VEC_LOOP(8, __m256i, LDI, LDI, _mm256_cmpeq_epi32(x, y), STT)
+        case 9: VEC_LOOP(8, __m256i, LDI, LDI, _mm256_cmpeq_epi32(x, y), STN)
+        default: break; // no integer division
+    }
+    #undef LDI
+    #undef STV
+    #undef STT
+    #undef STN
+    return k;
+}
+
+static size_t sse2Kernel(const int& op, const float* a, const size_t& as, const float* b, const size_t& bs, void* r, const size_t& n)
+{
+    size_t k = 0;
+    const __m128 va = _mm_set1_ps(*a), vb = _mm_set1_ps(*b);
+    const __m128i one = _mm_set1_epi32(1);
+    float* rf = (float*)r;
+    int* ri = (int*)r;
+    #define STF(e) _mm_storeu_ps(rf + k, e)
+    #define STI(e) _mm_storeu_si128((__m128i*)(ri + k), _mm_and_si128(_mm_castps_si128(e), one))
+    switch(op)
+    {
+        case 0: VEC_LOOP(4, __m128, _mm_loadu_ps, _mm_loadu_ps, _mm_add_ps(x, y), STF)
+        case 1: VEC_LOOP(4, __m128, _mm_loadu_ps, _mm_loadu_ps, _mm_sub_ps(x, y), STF)
+        case 2: VEC_LOOP(4, __m128, _mm_loadu_ps, _mm_loadu_ps, _mm_mul_ps(x, y), STF)
+        case 3: VEC_LOOP(4, __m128, _mm_loadu_ps, _mm_loadu_ps, _mm_div_ps(x, y), STF)
+        case 4: VEC_LOOP(4, __m128, _mm_loadu_ps, _mm_loadu_ps, _mm_cmplt_ps(x, y), STI)
+        case 5: VEC_LOOP(4, __m128, _mm_loadu_ps, _mm_loadu_ps, _mm_cmpgt_ps(x, y), STI)
+        case 6: VEC_LOOP(4, __m128, _mm_loadu_ps, _mm_loadu_ps, _mm_cmple_ps(x, y), STI)
+        case 7: VEC_LOOP(4, __m128, _mm_loadu_ps, _mm_loadu_ps, _mm_cmpge_ps(x, y), STI)
+        case 8: VEC_LOOP(4, __m128, _mm_loadu_ps, _mm_loadu_ps, _mm_cmpeq_ps(x, y), STI)
+        case 9: VEC_LOOP(4, __m128, _mm_loadu_ps, _mm_loadu_ps, _mm_cmpneq_ps(x, y), STI)
+        default: break;
+    }
+    #undef STF
+    #undef STI
+    return k;
+}
+
+static size_t sse2Kernel(const int& op, const int* a, const size_t& as, const int* b, const size_t& bs, void* r, const size_t& n)
+{
+    size_t k = 0;
+    const __m128i va = _mm_set1_epi32(*a), vb = _mm_set1_epi32(*b);
+    const __m128i one = _mm_set1_epi32(1);
+    int* ri = (int*)r;
+    #define LDI(p) _mm_loadu_si128((const __m128i*)(p))
+    #define STV(e) _mm_storeu_si128((__m128i*)(ri + k), e)
+    #define STT(e) STV(_mm_and_si128(e, one))
+    #define STN(e) STV(_mm_andnot_si128(e, one))
+    switch(op)
+    {
+        case 0: VEC_LOOP(4, __m128i, LDI, LDI, _mm_add_epi32(x, y), STV)
+        case 1: VEC_LOOP(4, __m128i, LDI, LDI, _mm_sub_epi32(x, y), STV)
+        case 4: VEC_LOOP(4, __m128i, LDI, LDI, _mm_cmplt_epi32(x, y), STT)
+        case 5: VEC_LOOP(4, __m128i, LDI, LDI, _mm_cmpgt_epi32(x, y), STT)
+        case 6: VEC_LOOP(4, __m128i, LDI, LDI, _mm_cmpgt_epi32(x, y), STN)
+        case 7: VEC_LOOP(4, __m128i, LDI, LDI, _mm_cmplt_epi32(x, y), STN)
+        case 8: VEC_LOOP(4, __m128i, LDI, LDI, _mm_cmpeq_epi32(x, y), STT)
+        case 9: VEC_LOOP(4, __m128i, LDI, LDI, _mm_cmpeq_epi32(x, y), STN)
+        default: break; // the 32 bits multiplication needs SSE4.1
+    }
+    #undef LDI
+    #undef STV
+    #undef STT
+    #undef STN
+    return k;
+}
+#undef VEC_LOOP
+
+// reductions (op: 0 sum, 1 min, 2 max, 3 dot product of a and b), acc holds the first element for min and max
+__attribute__((target("avx2"))) static size_t avx2Reduce(const int& op, const float* a, const float* b, const size_t& n, float& acc)
+{
+    size_t k = 0;
+    float tmp[8];
+    __m256 v = _mm256_set1_ps(op == 0 || op == 3 ? 0.f : acc);
+    for(; k + 8 <= n; k += 8)
+    {
+        __m256 x = _mm256_loadu_ps(a + k);
+        switch(op)
+        {
+            case 0: v = _mm256_add_ps(v, x); break;
+            case 1: v = _mm256_min_ps(v, x); break;
+            case 2: v = _mm256_max_ps(v, x); break;
+            default: v = _mm256_add_ps(v, _mm256_mul_ps(x, _mm256_loadu_ps(b + k))); break;
+        }
+    }
+    _mm256_storeu_ps(tmp, v);
+    for(int j = 0; j < 8 && k; ++j)
+    {
+        switch(op)
+        {
+            case 1: acc = std::min(acc, tmp[j]); break;
+            case 2: acc = std::max(acc, tmp[j]); break;
+            default: acc += tmp[j]; break;
+        }
+    }
+    return k;
+}
+
+__attribute__((target("avx2"))) static size_t avx2Reduce(const int& op, const int* a, const int* b, const size_t& n, int& acc)
+{
+    size_t k = 0;
+    int tmp[8];
+    __m256i v = _mm256_set1_epi32(op == 0 || op == 3 ? 0 : acc);
+    for(; k + 8 <= n; k += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + k));
+        switch(op)
+        {
+            case 0: v = _mm256_add_epi32(v, x); break;
+            case 1: v = _mm256_min_epi32(v, x); break;
+            case 2: v = _mm256_max_epi32(v, x); break;
+            default: v = _mm256_add_epi32(v, _mm256_mullo_epi32(x, _mm256_loadu_si256((const __m256i*)(b + k)))); break;
+        }
+    }
+    _mm256_storeu_si256((__m256i*)tmp, v);
+    for(int j = 0; j < 8 && k; ++j)
+    {
+        switch(op)
+        {
+            case 1: acc = std::min(acc, tmp[j]); break;
+            case 2: acc = std::max(acc, tmp[j]); break;
+            default: acc += tmp[j]; break;
+        }
+    }
+    return k;
 }
 
-int Script::get_while_loop_point()
+static size_t sse2Reduce(const int& op, const float* a, const float* b, const size_t& n, float& acc)
 {
-    #warning "review this function"
-    if(code[id].while_map.find(pc) != code[id].while_map.end())
-        return code[id].while_map[pc];
+    size_t k = 0;
+    float tmp[4];
+    __m128 v = _mm_set1_ps(op == 0 || op == 3 ? 0.f : acc);
+    for(; k + 4 <= n; k += 4)
+    {
+        __m128 x = _mm_loadu_ps(a + k);
+        switch(op)
+        {
+            case 0: v = _mm_add_ps(v, x); break;
+            case 1: v = _mm_min_ps(v, x); break;
+            case 2: v = _mm_max_ps(v, x); break;
+            default: v = _mm_add_ps(v, _mm_mul_ps(x, _mm_loadu_ps(b + k))); break;
+        }
+    }
+    _mm_storeu_ps(tmp, v);
+    for(int j = 0; j < 4 && k; ++j)
+    {
+        switch(op)
+        {
+            case 1: acc = std::min(acc, tmp[j]); break;
+            case 2: acc = std::max(acc, tmp[j]); break;
+            default: acc += tmp[j]; break;
+        }
+    }
+    return k;
+}
 
-    std::vector<const Value*> vs;
-    vs.push_back(&code[id].line[pc].params.back());
+static size_t sse2Reduce(const int& op, const int* a, const int*, const size_t& n, int& acc)
+{
+    if(op != 0) // min, max and the multiplication need SSE4.1
+        return 0;
+    size_t k = 0;
+    int tmp[4];
+    __m128i v = _mm_setzero_si128();
+    for(; k + 4 <= n; k += 4)
+        v = _mm_add_epi32(v, _mm_loadu_si128((const __m128i*)(a + k)));
+    _mm_storeu_si128((__m128i*)tmp, v);
+    for(int j = 0; j < 4; ++j)
+        acc += tmp[j];
+    return k;
+}
+#endif
 
-    if(vs.back()->getType() != RESULT)
+template <class T> static void arrayKernel(const int& op, const T* a, const size_t& as, const T* b, const size_t& bs, void* r, const size_t& n)
+{
+    size_t k = 0;
+    if(n == 0) // the numbers are read through a
+        return;
+    #ifdef SCRIPT_SIMD
+    switch(simdLevel())
+    {
+        case VEC_AVX2: k = avx2Kernel(op, a, as, b, bs, r, n); break;
+        case VEC_SSE2: k = sse2Kernel(op, a, as, b, bs, r, n); break;
+        default: break;
+    }
+    #endif
+    T* rt = (T*)r;
+    int* ri = (int*)r;
+    for(; k < n; ++k)
     {
-        code[id].while_map[pc] = pc;
-        return pc;
+        const T& x = a[k * as];
+        const T& y = b[k * bs];
+        switch(op)
+        {
+            case 0: rt[k] = x + y; break;
+            case 1: rt[k] = x - y; break;
+            case 2: rt[k] = x * y; break;
+            case 3: rt[k] = x / y; break;
+            case 4: ri[k] = (x < y); break;
+            case 5: ri[k] = (x > y); break;
+            case 6: ri[k] = (x <= y); break;
+            case 7: ri[k] = (x >= y); break;
+            case 8: ri[k] = (x == y); break;
+            default: ri[k] = (x != y); break;
+        }
     }
+}
 
-    int i = pc-1;
-    bool found;
-    for(; i > 0; --i)
+// n > 0 for min and max
+template <class T> static T arrayReduce(const int& op, const T* a, const T* b, const size_t& n)
+{
+    size_t k = 0;
+    T acc = (op == 0 || op == 3 ? 0 : a[0]);
+    #ifdef SCRIPT_SIMD
+    switch(simdLevel())
     {
-        Line& l = code[id].line[i];
+        case VEC_AVX2: k = avx2Reduce(op, a, b, n, acc); break;
+        case VEC_SSE2: k = sse2Reduce(op, a, b, n, acc); break;
+        default: break;
+    }
+    #endif
+    for(; k < n; ++k)
+    {
+        switch(op)
+        {
+            case 0: acc += a[k]; break;
+            case 1: acc = std::min(acc, a[k]); break;
+            case 2: acc = std::max(acc, a[k]); break;
+            default: acc += a[k] * b[k]; break;
+        }
+    }
+    return acc;
+}
 
-        found = false;
-        if(l.op.getType() == COP)
+// operand of a whole array operation: numbers are read as arrays of step 0, int arrays are converted if the other operand is a float,
+// boxed arrays of numbers are read as float arrays
+struct VectorOperand
+{
+    bool set(const void* u, const int& t)
+    {
+        a = nullptr;
+        switch(t)
         {
-            switch(*l.op.get<int>())
-            {
-                case 0:
-                    for(size_t x = 0; x < vs.size(); ++x)
-                    {
-                        if(l.params[0] == *vs[x])
-                        {
-                            vs.erase(vs.begin()+x);
-                            found = true;
-                            break;
-                        }
-                    }
-                    if(found && (/*l.params[1].getType() == CVAR ||*/ l.params[1].getType() == RESULT))
-                        vs.push_back(&l.params[1]);
-                    break;
-                case 2:
-                    if(l.hasResult && l.params.size() == 2)
-                    {
-                        for(size_t x = 0; x < vs.size(); ++x)
-                        {
-                            if(l.params[1] == *vs[x])
-                            {
-                                vs.erase(vs.begin()+x);
-                                found = true;
-                                break;
-                            }
-                        }
-                        if(found && (/*l.params[0].getType() == CVAR ||*/ l.params[0].getType() == RESULT))
-                            vs.push_back(&l.params[0]);
-                        break;
-                    }
-                default:
+            case INT: i = *(const int*)u; f = (float)i; isFloat = false; return true;
+            case FLOAT: f = *(const float*)u; isFloat = true; return true;
+            case ARRAY:
+                a = (const Array*)u;
+                isFloat = (a->type == FLOAT);
+                if(a->type != TBD || a->size() == 0) return true;
+                conv.resize(a->v.size()); // boxed elements: read as floats if they are all numbers
+                for(size_t k = 0; k < conv.size(); ++k)
                 {
-                    if(l.hasResult)
-                    {
-                        for(size_t x = 0; x < vs.size(); ++x)
-                        {
-                            if(l.params.back() == *vs[x])
-                            {
-                                vs.erase(vs.begin()+x);
-                                found = true;
-                                break;
-                            }
-                        }
-                    }
-
-                    if(found)
-                    {
-                        size_t n = l.params.size() - (l.hasResult ? 1 : 0);
-                        for(size_t j = 0; j < n; ++j)
-                        {
-                            if(found && (/*l.params[j].getType() == CVAR ||*/ l.params[j].getType() == RESULT))
-                                vs.push_back(&l.params[j]);
-                        }
-                    }
+                    const Value& x = a->v[k];
+                    if(x.getType() == INT) conv[k] = (float)*x.get<int>();
+                    else if(x.getType() == FLOAT) conv[k] = *x.get<float>();
+                    else return false;
                 }
-            }
+                isFloat = true;
+                return true;
+            default: return false;
         }
-        else
+    }
+    const int* ints() const { return (a ? a->i.data() : &i); }
+    const float* floats()
+    {
+        if(!a) return &f;
+        if(a->type == FLOAT) return a->f.data();
+        if(a->type == TBD) return conv.data();
+        conv.assign(a->i.begin(), a->i.end());
+        return conv.data();
+    }
+    size_t step() const { return (a ? 1 : 0); }
+
+    const Array* a;
+    int i;
+    float f;
+    bool isFloat;
+    std::vector<float> conv;
+};
+
+// + - * / < > <= >= == != (and the assignments) between two arrays of the same size or an array and a number, element by element
+void Script::vectorOperation(const int& op, Value* V[2], const int& target, const int& ttype)
+{
+    int kop, t[2];
+    VectorOperand w[2];
+    switch(op)
+    {
+        case 1: case 20: kop = 0; break;
+        case 2: case 21: kop = 1; break;
+        case 3: case 22: kop = 2; break;
+        case 4: case 23: kop = 3; break;
+        case 8: kop = 4; break;
+        case 7: kop = 5; break;
+        case 10: kop = 6; break;
+        case 9: kop = 7; break;
+        case 11: kop = 8; break;
+        case 6: kop = 9; break;
+        default: setError("this operation doesn't apply to arrays"); return;
+    }
+    for(int k = 0; k < 2; ++k)
+    {
+        const void* u = getValueContent(*V[k], t[k]);
+        if(!w[k].set(u, t[k]))
         {
-            if(l.hasResult)
-            {
-                for(size_t x = 0; x < vs.size(); ++x)
-                {
-                    if(l.params.back() == *vs[x])
-                    {
-                        vs.erase(vs.begin()+x);
-                        found = true;
-                        break;
-                    }
-                }
-            }
-            if(found)
+            setError("whole array operations need numbers or arrays of numbers");
+            return;
+        }
+    }
+    const size_t n = (w[0].a ? w[0].a->size() : w[1].a->size());
+    if(w[0].a && w[1].a && w[0].a->size() != w[1].a->size())
+    {
+        setError("array sizes don't match (" + std::to_string(w[0].a->size()) + " and " + std::to_string(w[1].a->size()) + ")");
+        return;
+    }
+    const bool isFloat = (w[0].isFloat || w[1].isFloat);
+    const int rtype = (kop >= 4 ? INT : (isFloat ? FLOAT : INT));
+    const float* fp[2] = {nullptr, nullptr};
+    const int* ip[2] = {nullptr, nullptr};
+    for(int k = 0; k < 2; ++k)
+    {
+        if(isFloat) fp[k] = w[k].floats();
+        else ip[k] = w[k].ints();
+    }
+    if(kop == 3) // division by zero
+    {
+        for(size_t k = 0; k < (w[1].a ? n : 1); ++k)
+        {
+            if(isFloat ? fp[1][k] == 0.f : ip[1][k] == 0)
             {
-                size_t n = l.params.size() - (l.hasResult ? 1 : 0);
-                for(size_t j = 0; j < n; ++j)
-                {
-                    if(found && (/*l.params[j].getType() == CVAR ||*/ l.params[j].getType() == RESULT))
-                        vs.push_back(&l.params[j]);
-                }
+                setError("division by zero");
+                return;
             }
         }
-        if(vs.empty())
-            break;
     }
-    code[id].while_map[pc] = i;
-    return i;
+
+    // a = a op b or a op= b: the result is written in a if it isn't shared
+    Array* r = nullptr;
+    Value& dst = (ttype == RESULT ? currentRegs[target] : (ttype == CVAR ? currentVars[target] : (ttype == SVAR ? scriptVars[target] : globalVars[target])));
+    bool inPlace = (V[0]->getType() == ttype && *(V[0]->get<int>()) == target && w[0].a && w[0].a->refs == 1 && w[0].a->type == rtype);
+    if(inPlace) r = dst.modifyArray();
+    else
+    {
+        r = new Array();
+        r->type = rtype;
+        if(rtype == INT) r->i.resize(n);
+        else r->f.resize(n);
+    }
+    void* out = (rtype == INT ? (void*)r->i.data() : (void*)r->f.data());
+    if(isFloat) arrayKernel(kop, fp[0], w[0].step(), fp[1], w[1].step(), out, n);
+    else arrayKernel(kop, ip[0], w[0].step(), ip[1], w[1].step(), out, n);
+    if(!inPlace)
+    {
+        Value v;
+        v.set(r, ARRAY);
+        setVar(target, v, ttype);
+        v.clear();
+    }
+}
+
+// sum(a), min(a), max(a), dot(a, b)
+static void reduceArray(Script* s, Line& l, const int& op)
+{
+    const size_t argn = (op == 3 ? 2 : 1);
+    if(l.params.size() != argn + (l.hasResult ? 1 : 0))
+    {
+        s->setError();
+        return;
+    }
+    VectorOperand w[2];
+    for(size_t k = 0; k < argn; ++k)
+    {
+        int t;
+        const void* u = s->getValueContent(l.params[k], t);
+        if(t != ARRAY || !w[k].set(u, t))
+        {
+            s->setError("sum(), min(), max() and dot() need arrays of numbers");
+            return;
+        }
+    }
+    const size_t n = w[0].a->size();
+    if(op == 3 && w[1].a->size() != n)
+    {
+        s->setError("dot(): array sizes don't match");
+        return;
+    }
+    if((op == 1 || op == 2) && n == 0)
+    {
+        s->setError("min() or max() of an empty array");
+        return;
+    }
+    if(w[0].isFloat || (op == 3 && w[1].isFloat))
+    {
+        const float* a = w[0].floats();
+        s->funcReturn(arrayReduce(op, a, (op == 3 ? w[1].floats() : a), n), l);
+    }
+    else s->funcReturn(arrayReduce(op, w[0].ints(), (op == 3 ? w[1].ints() : w[0].ints()), n), l);
+}
+
+void Script::_sum(Script* s, Line& l)
+{
+    reduceArray(s, l, 0);
+}
+
+void Script::_min(Script* s, Line& l)
+{
+    reduceArray(s, l, 1);
+}
+
+void Script::_max(Script* s, Line& l)
+{
+    reduceArray(s, l, 2);
+}
+
+void Script::_dot(Script* s, Line& l)
+{
+    reduceArray(s, l, 3);
+}
+
+int Script::get_while_loop_point()
+{
+    // the loop points are marked by the compiler and resolved at load time
+    auto it = code[id].while_map.find(pc);
+    if(it != code[id].while_map.end())
+        return it->second;
+    return pc;
 }
 
-void Script::addGlobalFunction(const std::string& name, Callback callback, const size_t &argn)
+void Script::addGlobalFunction(const std::string& name, Callback callback, const size_t &argn, const int& attributes)
 {
     gl_func[name] = argn;
-    gl_callback.insert(std::pair<std::string, Callback>(name, callback));
+    gl_attr[name] = attributes;
+    gl_callback[name] = callback; // replaces a builtin of the same name
+    gl_builtin.erase(name);
+}
+
+void Script::addConstant(const std::string& name, const int& value)
+{
+    gl_const[name] = {std::to_string(value), INT};
+}
+
+void Script::addConstant(const std::string& name, const float& value)
+{
+    std::ostringstream ss;
+    ss << std::setprecision(9) << value; // enough digits to get the same float back
+    gl_const[name] = {ss.str(), FLOAT};
+}
+
+void Script::addConstant(const std::string& name, const std::string& value)
+{
+    gl_const[name] = {"\"" + value + "\"", STR};
+}
+
+void Script::setCompileCache(const std::string& folder)
+{
+    compile_cache = folder;
+}
+
+void Script::setInlineLimit(const size_t& n)
+{
+    inline_limit = n;
 }
 
 void Script::initGlobalVariables(const size_t& n)
 {
+    for(size_t i = n; i < globalVars.size(); ++i)
+    {
+        globalVars[i].unbind();
+        globalVars[i].clear();
+    }
     globalVars.resize(n);
+    for(auto it = gl_var.begin(); it != gl_var.end();)
+    {
+        if(it->second >= n) it = gl_var.erase(it);
+        else ++it;
+    }
+}
+
+size_t Script::addGlobalVariable(const std::string& name)
+{
+    auto it = gl_var.find(name);
+    if(it != gl_var.end())
+        return it->second;
+    gl_var[name] = globalVars.size();
+    globalVars.emplace_back();
+    return globalVars.size() - 1;
+}
+
+bool Script::bindGlobalVariable(const size_t& i, int* host)
+{
+    if(i >= globalVars.size() || !host) return false;
+    globalVars[i].bind(host, INT);
+    return true;
+}
+
+bool Script::bindGlobalVariable(const size_t& i, float* host)
+{
+    if(i >= globalVars.size() || !host) return false;
+    globalVars[i].bind(host, FLOAT);
+    return true;
 }
 
 std::vector<Value>& Script::getGlobalVariables()
@@ -2756,8 +6866,58 @@ std::vector<Value>& Script::getGlobalVariables()
 
 void Script::clearGlobalVariables()
 {
-    for(auto &i: globalVars) i.clear();
+    for(auto &i: globalVars)
+    {
+        i.unbind();
+        i.clear();
+    }
     globalVars.clear();
+    gl_var.clear();
+}
+
+// prints a value content (arrays and dictionaries included)
+static void printContent(const void* p, const int& type)
+{
+    switch(type)
+    {
+        case INT: std::cout << *(const int*)p; break;
+        case FLOAT: std::cout << *(const float*)p; break;
+        case STR: std::cout << *(const std::string*)p; break;
+        case ARRAY:
+        {
+            const Array& a = *(const Array*)p;
+            std::cout << "[";
+            for(size_t k = 0; k < a.size(); ++k)
+            {
+                if(k) std::cout << ", ";
+                switch(a.type)
+                {
+                    case INT: std::cout << a.i[k]; break;
+                    case FLOAT: std::cout << a.f[k]; break;
+                    default: printContent(a.v[k].getP(), a.v[k].getType()); break;
+                }
+            }
+            std::cout << "]";
+            break;
+        }
+        case DICT:
+        {
+            bool first = true;
+            std::cout << "{";
+            for(auto &x: ((const Dict*)p)->slots)
+            {
+                if(x.type != INT && x.type != STR) continue;
+                if(!first) std::cout << ", ";
+                first = false;
+                if(x.type == INT) std::cout << x.i << ": ";
+                else std::cout << *(const std::string*)x.s << ": ";
+                printContent(x.v.getP(), x.v.getType());
+            }
+            std::cout << "}";
+            break;
+        }
+        default: break;
+    }
 }
 
 void Script::printValue(const Value& v, const bool& isContent)
@@ -2767,14 +6927,15 @@ void Script::printValue(const Value& v, const bool& isContent)
         case INT: std::cout << "value -> " << *v.get<int>() << std::endl; break;
         case FLOAT: std::cout << "value -> " << *v.get<float>() << std::endl; break;
         case STR: std::cout << "value -> " << *v.get<std::string>() << std::endl; break;
-        case CVAR: case RESULT: case GVAR:
+        case ARRAY: case DICT: std::cout << "value -> "; printContent(v.getP(), v.getType()); std::cout << std::endl; break;
+        case CVAR: case RESULT: case GVAR: case SVAR:
             if(isContent)
             {
                 std::cout << "error" << std::endl;
             }
             else
             {
-                std::cout << (v.getType() == RESULT ? "register [" : "variable [") << (v.getType() == GVAR ? "G" : "") << *v.get<int>() << "] -> ";
+                std::cout << (v.getType() == RESULT ? "register [" : "variable [") << (v.getType() == GVAR ? "G" : (v.getType() == SVAR ? "S" : "")) << *v.get<int>() << "] -> ";
                 if(loaded) printValue(getVar(v), true);
                 else std::cout << "???" << std::endl;
             }
@@ -2839,6 +7000,16 @@ void Script::_if(Script* s, Line& l)
     else s->skipBlock(true);
 }
 
+void Script::_elif(Script* s, Line& l)
+{
+    if(!s->canElse) // a previous block of the chain was executed
+    {
+        s->skipBlock(false);
+        return;
+    }
+    _if(s, l);
+}
+
 void Script::_else(Script* s, Line& l)
 {
     if(l.hasResult)
@@ -2846,7 +7017,8 @@ void Script::_else(Script* s, Line& l)
         s->setError();
         return;
     }
-    s->enterBlock(false);
+    if(s->canElse) s->enterBlock(false);
+    else s->skipBlock(false);
 }
 
 void Script::_return(Script* s, Line& l)
@@ -2858,7 +7030,8 @@ void Script::_return(Script* s, Line& l)
     }
     switch(l.params[0].getType())
     {
-        case CVAR: case GVAR: case RESULT: s->ret(&s->getVar(l.params[0])); break;
+        case CVAR: case RESULT: s->ret(&s->getVar(l.params[0]), true); break;
+        case GVAR: case SVAR: s->ret(&s->getVar(l.params[0])); break;
         default: s->ret(&l.params[0]); break;
     }
 }
@@ -2899,10 +7072,103 @@ void Script::_print(Script* s, Line& l)
         case INT: std::cout << *(const int*)p << std::endl; break;
         case FLOAT: std::cout << *(const float*)p << std::endl; break;
         case STR: std::cout << *(const std::string*)p << std::endl; break;
+        case ARRAY: case DICT: printContent(p, type); std::cout << std::endl; break;
         default: s->setError(); return;
     }
 }
 
+void Script::_array(Script* s, Line& l)
+{
+    if(l.params.size() != (l.hasResult ? 2 : 1))
+    {
+        s->setError();
+        return;
+    }
+    int type;
+    const void* p = s->getValueContent(l.params[0], type);
+    if(type != INT || *(const int*)p < 0)
+    {
+        s->setError("array(): the size must be a positive integer");
+        return;
+    }
+    Value v;
+    v.set(new Array(*(const int*)p), ARRAY);
+    s->funcReturn(v, l);
+    v.clear();
+}
+
+void Script::_size(Script* s, Line& l)
+{
+    if(l.params.size() != (l.hasResult ? 2 : 1))
+    {
+        s->setError();
+        return;
+    }
+    int type;
+    const void* p = s->getValueContent(l.params[0], type);
+    switch(type)
+    {
+        case ARRAY: s->funcReturn((int)((const Array*)p)->size(), l); break;
+        case DICT: s->funcReturn((int)((const Dict*)p)->size(), l); break;
+        case STR: s->funcReturn((int)((const std::string*)p)->size(), l); break;
+        default: s->setError("size(): not an array, a dictionary or a string"); return;
+    }
+}
+
+void Script::_dict(Script* s, Line& l)
+{
+    if(l.params.size() != (l.hasResult ? 1 : 0))
+    {
+        s->setError();
+        return;
+    }
+    Value v;
+    v.set(new Dict(), DICT);
+    s->funcReturn(v, l);
+    v.clear();
+}
+
+// keys of a dictionary, in an array (in the table order)
+void Script::_keys(Script* s, Line& l)
+{
+    if(l.params.size() != (l.hasResult ? 2 : 1))
+    {
+        s->setError();
+        return;
+    }
+    int type;
+    const void* p = s->getValueContent(l.params[0], type);
+    if(type != DICT)
+    {
+        s->setError("keys(): not a dictionary");
+        return;
+    }
+    const Dict& d = *(const Dict*)p;
+    Array* a = new Array();
+    for(auto &x: d.slots)
+    {
+        if(x.type == INT && a->type == INT) a->i.push_back(x.i);
+        else if(x.type == INT || x.type == STR)
+        {
+            if(a->type == INT) // a string key: the keys are boxed
+            {
+                a->type = TBD;
+                a->v.resize(a->i.size());
+                for(size_t k = 0; k < a->i.size(); ++k)
+                    a->v[k].set(a->i[k]);
+                std::vector<int>().swap(a->i);
+            }
+            a->v.push_back(Value());
+            if(x.type == INT) a->v.back().set(x.i);
+            else a->v.back().share((const std::string*)x.s, STR);
+        }
+    }
+    Value v;
+    v.set(a, ARRAY);
+    s->funcReturn(v, l);
+    v.clear();
+}
+
 void Script::_debug(Script* s, Line& l)
 {
     if(l.hasResult)
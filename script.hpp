@@ -9,10 +9,14 @@
 #include <list>
 #include <stack>
 #include <utility>
+#include <cstdint>
 #include <functional>
+#include <atomic>
+#include <istream>
+#include <ostream>
 
 // enum used at compile and run time
-enum {INVALID, STR, INT, FLOAT, OPERATOR, LBRK, RBRK, COMMA, LCUR, RCUR, FUNC, VAR, RESULT, CVAR, COP, CFUNC, GFUNC, GVAR, TBD};
+enum {INVALID, STR, INT, FLOAT, OPERATOR, LBRK, RBRK, COMMA, LCUR, RCUR, FUNC, VAR, RESULT, CVAR, COP, CFUNC, GFUNC, GVAR, TBD, ARRAY, DICT, SVAR};
 //***************************************************************************************************************
 // COMPILE
 //***************************************************************************************************************
@@ -28,7 +32,12 @@ struct Token
     Token(const std::string& s, const int& t, const int& o = UNDEF): s(s), t(t), o(o) {}
     Token(Token &cpy): s(cpy.s), t(cpy.t), o(cpy.o) {}
 
-    bool isIntValue() const { return (t == INT || t == RESULT || t == CVAR || t == COP || t == GVAR); }
+    static thread_local std::atomic<size_t>* allocations; // counter of the compile collecting statistics on this thread (nullptr: not counted)
+    static void count(); // increments *allocations if set
+    static void* operator new(size_t n) { count(); return ::operator new(n); }
+    static void operator delete(void* p) { ::operator delete(p); }
+
+    bool isIntValue() const { return (t == INT || t == RESULT || t == CVAR || t == COP || t == GVAR || t == SVAR); }
     bool isFloatValue() const { return (t == FLOAT); }
     bool isStringValue() const { return (t == STR); }
     bool isNumber() const { return (t == INT || t == FLOAT); }
@@ -63,6 +72,8 @@ struct Instruction
     Token* op = nullptr;
     std::vector<Token*> params;
     bool hasResult = false;
+    bool loop = false; // first instruction of a while condition (where each iteration restarts)
+    std::vector<size_t> release; // registers holding a string to free after this instruction
 };
 
 struct Code
@@ -71,37 +82,153 @@ struct Code
     std::vector<Instruction> line;
     size_t creg = 0;
     size_t argn = 0;
+    bool partial = false; // only a part of the function (streaming compile)
+    std::vector<std::string> svar; // script variable names, by slot (main function only)
+    std::set<int> globalWrites; // global variables written by the function and its callees
+    std::set<int> scriptWrites; // same for the script variables
+    bool anyGlobalWrite = false; // calls a native function or pauses, any global variable can change
+    bool memo = false; // def memo: the results are cached by parameter values
+    bool pure = false; // no global or script variable, no output and only PURE natives, its callees included (required by memo)
+    std::vector<bool> scalarParams; // parameters always given an INT, FLOAT or STR by the callers (the operations on them can't fail)
 };
 
 typedef std::unordered_map<std::string, Code> Compiled;
 
+struct CompileStats
+{
+    enum { TOKENIZE, SHUNTINGYARD, FORMAT, ERRORCHECK, POSTPROCESSING, SAVE, PHASE_COUNT };
+    struct Phase
+    {
+        double time = 0; // wall time (microseconds)
+        size_t tokenAllocations = 0; // number of Token allocated during the phase (the other compiler allocations aren't counted)
+        size_t tokens = 0; // token count at the end of the phase
+        size_t instructions = 0; // instruction count at the end of the phase
+    };
+
+    bool cached = false; // true if the compile cache was used (the phases are then empty)
+    double time = 0; // total wall time (microseconds)
+    Phase phase[PHASE_COUNT];
+
+    std::string toJSON() const;
+};
+
 //***************************************************************************************************************
 // RUN
 //***************************************************************************************************************
+// content of a STR value: never modified while shared, copying a STR value only increments refs
+// (a Value still points to the std::string part, getValueContent() users see no difference)
+struct SharedString: public std::string
+{
+    SharedString(const std::string& s): std::string(s), refs(1) {}
+    SharedString(std::string&& s): std::string(std::move(s)), refs(1) {}
+    mutable size_t refs;
+};
+
+struct Array;
+struct Dict;
+
 class Value
 {
     public:
-        Value(): p(nullptr), t(TBD) {};
+        Value(): p(nullptr), t(TBD), bound(false) {};
         void clear(); // reminder: the memory must be FREE using clear
-        bool set(const void *any, const int& type);
+        bool set(const void *any, const int& type); // for STR, any is a std::string, its text is copied
         bool set(const int& v);
         bool set(const float& v);
         bool set(const std::string& v);
+        bool set(std::string&& v);
+        Array* modifyArray(); // ARRAY content, copied first if other values share it (nullptr if it's not an ARRAY)
+        Dict* modifyDict(); // same for a DICT
+        bool move(Value& v); // takes the content of v, which is left empty (no copy, no allocation)
+        void bind(void* host, const int& type); // the content is the host int or float *host: never freed, its type never changes (an assigned number is converted)
+        void unbind(); // back to an empty value, *host is left as is
+        bool isBound() const { return bound; }
         const int& getType() const { return t; }
         const void* getP() const { return p; }
         template <class T> const T* get() const { return (T*)p;}
-        bool operator==(const Value& rhs);
+        bool operator==(const Value& rhs) const;
 
     private:
+        friend class Script;
+        friend struct Array;
+        friend struct Dict;
+
+        bool share(const void* any, const int& type); // same as set(), except a STR content is shared: any must be the content of another STR value (getP() or getValueContent())
+        bool setBound(const void* any, const int& type);
+
         void* p;
         int t;
+        bool bound;
 };
 
+// content of an ARRAY value, shared like the strings: a value modifying it gets its own copy if refs > 1
+// the elements are stored unboxed while they all are INT (type INT, in i) or FLOAT (type FLOAT, in f), as values otherwise (type TBD, in v)
+struct Array
+{
+    Array(const size_t& n = 0): type(INT), i(n, 0), refs(0) {}
+    Array(const Array& a);
+    ~Array();
+    size_t size() const { return (type == INT ? i.size() : (type == FLOAT ? f.size() : v.size())); }
+
+    int type;
+    std::vector<int> i;
+    std::vector<float> f;
+    std::vector<Value> v;
+    mutable size_t refs; // values holding it
+};
+
+// content of a DICT value, shared like the arrays
+// open addressing table keyed by INT or STR (linear probing, power of 2 slot count): a slot holds the key hash, the key and its value
+struct Dict
+{
+    struct Slot // 32 bytes on 64 bits systems
+    {
+        Slot(): hash(0), type(TBD), s(nullptr) {}
+        uint32_t hash;
+        int type; // key type: INT or STR, TBD if the slot is free, INVALID if its key was removed
+        union
+        {
+            int i;
+            const SharedString* s; // shared with the value the key comes from
+        };
+        Value v;
+    };
+    Dict(): count(0), used(0), refs(0) {}
+    Dict(const Dict& d);
+    ~Dict();
+    const Value* find(const void* key, const int& type) const; // nullptr if the key isn't there
+    Value* insert(const void* key, const int& type); // value of the key, added if needed (key is an int or the content of a STR value)
+    bool erase(const void* key, const int& type);
+    size_t lookup(const void* key, const int& type, const uint32_t& hash) const; // slot of the key or free slot where it goes
+    void grow();
+    size_t size() const { return count; }
+
+    std::vector<Slot> slots;
+    size_t count; // keys
+    size_t used; // keys and removed keys
+    mutable size_t refs; // values holding it
+};
+
+// superinstructions, chosen at load time
+// FUSE_IF, FUSE_ELIF, FUSE_WHILE: comparison followed by the condition reading its result
+// FUSE_INC: local variable incremented by an INT constant, FUSE_INC_END: same, followed by a block end
+// FUSE_SWITCH: first comparison of an if/elif chain testing one variable against INT constants (see JumpTable)
+// FUSE_FOR: FUSE_INC_END closing a while loop whose condition is a single comparison, the comparison and the branch run with it
+enum {FUSE_NONE, FUSE_IF, FUSE_ELIF, FUSE_WHILE, FUSE_INC, FUSE_INC_END, FUSE_SWITCH, FUSE_FOR};
+
 struct Line
 {
     Value op;
     std::vector<Value> params;
     bool hasResult;
+    std::vector<int> release; // registers to free after this instruction
+    int fuse = FUSE_NONE; // if not FUSE_NONE, the line runs as a superinstruction (with the next line for all but FUSE_INC)
+};
+struct JumpTable
+{
+    size_t param; // parameter of the first comparison holding the tested variable
+    std::map<int, int> arms; // constant -> line of the if/elif of its block (the first one if several arms test the same constant)
+    int other; // end of the last block of the chain (where an else can follow)
 };
 struct Function
 {
@@ -110,10 +237,13 @@ struct Function
     size_t regn;
     std::vector<Line> line;
     std::map<int, int> while_map;
+    std::map<int, JumpTable> switch_map; // by line of the first comparison
+    bool memo = false;
 };
 typedef std::vector<Function> Runtime;
 
 class Script;
+class ThreadPool; // worker threads of a compile
 typedef void (*Callback)(Script*, Line&);
 typedef std::unordered_map<std::string, Callback>::iterator CallRef;
 
@@ -128,9 +258,11 @@ struct RunState
     int pc;
     size_t id;
     size_t scope;
+    bool canElse;
     std::stack<IfPos> ifstack;
     std::vector<Value> vars;
     std::vector<Value> regs;
+    bool memo = false; // the called function is memo, its result is cached (key in Script::memo_keys)
 };
 
 //***************************************************************************************************************
@@ -139,34 +271,56 @@ struct RunState
 class Script
 {
     public:
-        enum { NONE = 0, PRINT = 1 }; // flags
+        enum { NONE = 0, PRINT = 1, PARALLEL = 2, STATS = 4, STREAM = 8 }; // flags (PARALLEL: the per function compile steps are spread over all the cores, STATS: print the compile statistics as JSON, STREAM: compile with a bounded memory usage)
+        enum { PURE = 1, NO_GLOBAL_WRITES = 2, CHEAP = 4 }; // hard-coded function attributes (PURE: the result only depends on the parameters, no side effect and no error, NO_GLOBAL_WRITES: doesn't change the global or script variables, CHEAP: about as fast as an operator)
 
         Script();
         virtual ~Script();
         bool load(const std::string& file);
+        bool load(const std::vector<char>& program); // load a program compiled with compileFromString()
         bool run();
         void setError(const std::string& err = "");
-        void setVar(const int& i, const int& v, const int &type); // set the variable content to v (i is the variable id, type is CVAR, GVAR, RESULT)
+        void setVar(const int& i, const int& v, const int &type); // set the variable content to v (i is the variable id, type is CVAR, GVAR, SVAR, RESULT)
         void setVar(const int& i, const std::string& v, const int &type);
+        void setVar(const int& i, std::string&& v, const int &type); // the temporary string is moved in the variable
         void setVar(const int& i, const float& v, const int &type);
         void setVar(const int& i, const Value& v, const int &type);
         Value& getVar(const Value& v); // get the variable content (setError() if it's not a variable)
         const void* getValueContent(const Value& v, int &type); // get content and type stored in v. If v is a variable, return the variable content
+        std::vector<std::pair<std::string, size_t> > census() const; // pairs of consecutive instructions in the loaded program ("first second"), most frequent first
 
-        static bool compile(const std::string& file, const std::string& output, const char &flag = NONE);
+        static bool compile(const std::string& file, const std::string& output, const char &flag = NONE, CompileStats* stats = nullptr);
+        static bool compileFromString(const std::string& source, std::vector<char>& program, const char &flag = NONE, CompileStats* stats = nullptr); // compile in memory, without touching the file system
+        static void setCompileCache(const std::string& folder); // folder used to cache the compiled files (empty string to disable)
+        static void setInlineLimit(const size_t& n); // maximum instruction count of a function inlined at its call sites (0 to disable)
 
-        static void addGlobalFunction(const std::string& name, Callback callback, const size_t &argn);
+        static void addGlobalFunction(const std::string& name, Callback callback, const size_t &argn, const int& attributes = NONE); // a PURE function may be called by the compiler (parameters known at compile time), from any thread
+        static void addConstant(const std::string& name, const int& value); // the name is replaced by the value when compiling (must be used before compiling)
+        static void addConstant(const std::string& name, const float& value);
+        static void addConstant(const std::string& name, const std::string& value);
         static void initGlobalVariables(const size_t& n);
+        static size_t addGlobalVariable(const std::string& name); // adds a named global variable, @name in the scripts, and returns its id (must be used before compiling, after initGlobalVariables())
+        static bool bindGlobalVariable(const size_t& i, int* host); // the global variable i is stored in *host, read and written in place by the scripts (it stays an int)
+        static bool bindGlobalVariable(const size_t& i, float* host);
         static std::vector<Value>& getGlobalVariables();
         static void clearGlobalVariables();
 
         static void _if(Script* s, Line& l);
+        static void _elif(Script* s, Line& l);
         static void _else(Script* s, Line& l);
         static void _return(Script* s, Line& l);
         static void _while(Script* s, Line& l);
         static void _print(Script* s, Line& l);
         static void _debug(Script* s, Line& l);
         static void _break(Script* s, Line& l);
+        static void _array(Script* s, Line& l);
+        static void _size(Script* s, Line& l);
+        static void _sum(Script* s, Line& l);
+        static void _min(Script* s, Line& l);
+        static void _max(Script* s, Line& l);
+        static void _dot(Script* s, Line& l);
+        static void _dict(Script* s, Line& l);
+        static void _keys(Script* s, Line& l);
 
         bool rejectReturn(const Line& l);
         void funcReturn(const Value& v, Line& l);
@@ -175,20 +329,38 @@ class Script
         void funcReturn(const std::string& v, Line& l);
 
     protected:
-        static bool shuntingyard(const TokenIDList& tokens, Compiled& code);
-        static bool format(Program &prog, VariableList &vars, Compiled& code);
-        static int errorCheck(Compiled& code);
-        static bool postprocessing(Compiled& code);
-        static bool save(const std::string& output, const Compiled& code);
+        bool load(std::istream& f);
+        static bool compileStream(const std::string& file, const std::string& output, const char &flag, CompileStats* stats);
+        static bool compileChunk(const TokenIDList& tokens, Compiled& known, std::vector<std::pair<std::string, size_t> >& table, std::ostream& mainOut, std::ostream& funcOut, size_t &mainLines, ThreadPool& pool, CompileStats* stats);
+        static bool process(Compiled& code, ThreadPool& pool, CompileStats* stats);
+        static void freeCode(Compiled& code);
+        static bool shuntingyard(const TokenIDList& tokens, Compiled& code, ThreadPool& pool, CompileStats* stats);
+        static bool format(Program &prog, VariableList &vars, Compiled& code, ThreadPool& pool);
+        static bool formatFunction(TokenList &lines, std::set<std::string> &vars, Code& func, const Compiled& code);
+        static int errorCheck(Compiled& code, ThreadPool& pool);
+        static int errorCheckFunction(const Code& func, const Compiled& code);
+        static bool postprocessing(Compiled& code, ThreadPool& pool);
+        static bool postprocessFunction(Code& func, const Compiled& code);
+        static bool save(std::ostream& o, const Compiled& code);
+        static void saveHeader(std::ostream& o, const std::vector<std::pair<std::string, size_t> >& table, const size_t& svarn);
+        static void saveFunction(std::ostream& o, const Code& func);
+        static void saveLines(std::ostream& o, const std::vector<Instruction>& lines);
         static void print(Compiled& code);
         static void debug(Program& code);
 
         void operation(Line& line);
+        void fusedOperation(Line& line);
+        void arrayOperation(Line& line);
+        void dictOperation(Line& line);
+        void vectorOperation(const int& op, Value* V[2], const int& target, const int& ttype);
+        void branch(const int& fuse, const bool& r);
         void enterBlock(const bool& loop);
         void skipBlock(const bool& checkElse);
+        void endBlock();
         int get_while_loop_point();
         void push_stack(Line& line);
-        void ret(const Value* v);
+        bool memoKey(const Line& line, const size_t& argn, std::string& key);
+        void ret(Value* v, const bool& owned = false); // owned: v belongs to the returning function, its content is moved
 
         // debug
         void printValue(const Value& v, const bool& isContent = false);
@@ -203,9 +375,13 @@ class Script
         bool canElse;
         std::vector<Value> currentVars;
         std::vector<Value> currentRegs;
+        std::vector<Value> scriptVars; // $ variables, shared by all the functions of this instance
         std::stack<IfPos> ifstack;
         std::stack<RunState> call_stack;
         std::stack<Value*> return_stack;
+        bool silent; // setError() doesn't print (hard-coded functions called by the compiler)
+        std::vector<std::unordered_map<std::string, Value> > memo; // cached results of the memo functions, by function id
+        std::vector<std::string> memo_keys; // parameters of the memo calls in progress
 };
 
 #endif // SCRIPT_HPP